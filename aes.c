@@ -0,0 +1,88 @@
+/*
+ Authors:
+ Copyright 2012-2016 by Eduard Broese <ed.broese@gmx.de>
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version
+ 2 of the License, or (at your option) any later version.
+*/
+
+/*
+  aes : AES-128-CFB8 stream cipher used for the connection encryption
+*/
+
+#include <string.h>
+#include <assert.h>
+
+#include "aes.h"
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Encryption in CFB8 mode is inherently sequential - each byte of keystream
+// depends on the previous ciphertext, so we leave it to the EVP implementation.
+// Decryption however knows all ciphertext in advance, so the keystream for a
+// whole buffer is computed at once: every byte is preceded by a 16-byte window
+// of ciphertext, and all windows are run through AES-ECB in a single batch,
+// which the AES-NI implementation pipelines
+
+void aes_stream_init(aes_stream *as, const uint8_t *key, int dec) {
+    if (!as->ctx) as->ctx = EVP_CIPHER_CTX_new();
+    assert(as->ctx);
+
+    // Minecraft uses the shared secret both as the key and as the IV
+    memmove(as->sr, key, 16);
+    if (dec) {
+        EVP_EncryptInit_ex(as->ctx, EVP_aes_128_ecb(), NULL, key, NULL);
+        EVP_CIPHER_CTX_set_padding(as->ctx, 0);
+    }
+    else {
+        EVP_EncryptInit_ex(as->ctx, EVP_aes_128_cfb8(), NULL, key, key);
+    }
+}
+
+void aes_stream_free(aes_stream *as) {
+    if (as->ctx) EVP_CIPHER_CTX_free(as->ctx);
+    as->ctx = NULL;
+}
+
+void aes_encrypt(aes_stream *as, uint8_t *src, uint8_t *dst, ssize_t len) {
+    int olen;
+    EVP_EncryptUpdate(as->ctx, dst, &olen, src, len);
+}
+
+void aes_decrypt(aes_stream *as, uint8_t *src, uint8_t *dst, ssize_t len) {
+    uint8_t win[AES_BATCH*16], ks[AES_BATCH*16];
+
+    while (len > 0) {
+        int n = (len < AES_BATCH) ? len : AES_BATCH;
+
+        // ciphertext windows for each byte: shift register followed by the data
+        int i;
+        for(i=0; i<n && i<16; i++) {
+            memmove(win+i*16, as->sr+i, 16-i);
+            memmove(win+i*16+16-i, src, i);
+        }
+        for(; i<n; i++)
+            memmove(win+i*16, src+i-16, 16);
+
+        int olen;
+        EVP_EncryptUpdate(as->ctx, ks, &olen, win, n*16);
+
+        // update the shift register before the output may overwrite the input
+        if (n >= 16) {
+            memmove(as->sr, src+n-16, 16);
+        }
+        else {
+            memmove(as->sr, as->sr+n, 16-n);
+            memmove(as->sr+16-n, src, n);
+        }
+
+        for(i=0; i<n; i++)
+            dst[i] = src[i] ^ ks[i*16];
+
+        src += n;
+        dst += n;
+        len -= n;
+    }
+}
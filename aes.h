@@ -0,0 +1,29 @@
+/*
+ Authors:
+ Copyright 2012-2016 by Eduard Broese <ed.broese@gmx.de>
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version
+ 2 of the License, or (at your option) any later version.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <openssl/evp.h>
+
+// AES-128-CFB8 stream cipher
+
+#define AES_BATCH 1024  // bytes decrypted per batch
+
+typedef struct {
+    EVP_CIPHER_CTX *ctx;    // CFB8 context for encryption, ECB for decryption
+    uint8_t         sr[16]; // last 16 bytes of ciphertext, for decryption
+} aes_stream;
+
+void aes_stream_init(aes_stream *as, const uint8_t *key, int dec);
+void aes_stream_free(aes_stream *as);
+void aes_encrypt(aes_stream *as, uint8_t *src, uint8_t *dst, ssize_t len);
+void aes_decrypt(aes_stream *as, uint8_t *src, uint8_t *dst, ssize_t len);
@@ -14,6 +14,16 @@
 
 #include <stdio.h>
 #include <assert.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <zlib.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include <lh_buffers.h>
 #include <lh_debug.h>
@@ -29,11 +39,26 @@ mca * anvil_create() {
     return region;
 }
 
+// check if the chunk data is a view into the region file mapping
+static inline int anvil_mapped(mca *region, uint8_t *data) {
+    return region->map && data>=region->map && data<region->map+region->mapsize;
+}
+
+// release chunk data, unless it's a view into the mapping
+static void anvil_release(mca *region, int idx) {
+    if (!anvil_mapped(region, region->data[idx]))
+        lh_free(region->data[idx]);
+    region->data[idx] = NULL;
+    region->len[idx] = 0;
+}
+
 // free a region include all chunks
 void anvil_free(mca * region) {
     int i;
     for(i=0; i<REGCHUNKS; i++)
-        lh_free(region->data[i]);
+        anvil_release(region, i);
+    if (region->map)
+        munmap(region->map, region->mapsize);
     lh_free(region);
 }
 
@@ -48,34 +73,72 @@ void anvil_dump(mca * region) {
     }
 }
 
-// load an anvil region from disk
+// load an anvil region from disk - the file is mapped and the chunk data
+// references the mapping, so only the pages of the chunks actually
+// accessed are read
 mca * anvil_load(const char *path) {
-    uint8_t *buf;
-    ssize_t sz = lh_load_alloc(path, &buf);
-    if (sz<=0) return NULL;
+    int fd = open(path, O_RDONLY);
+    if (fd<0) return NULL;
+
+    struct stat st;
+    if (fstat(fd, &st) || st.st_size < 8192) {
+        close(fd);
+        return NULL;
+    }
+
+    uint8_t *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return NULL;
 
     lh_create_obj(mca, region);
+    region->map = map;
+    region->mapsize = st.st_size;
+    region->nsect = (st.st_size+4095)>>12;
 
     int i;
-    uint8_t *p = buf;
-    uint8_t *t = buf+4096;
+    uint8_t *p = map;
+    uint8_t *t = map+4096;
     for(i=0; i<REGCHUNKS; i++) {
         uint32_t choff = lh_read_int_be(p);
         region->ts[i] = lh_read_int_be(t);
         if (choff) { // this chunk is non-empty
+            ssize_t off  = (ssize_t)(choff>>8)<<12;
             ssize_t clen = (choff&0xff)<<12;
-            lh_alloc_buf(region->data[i], clen);
-            memmove(region->data[i], buf+((choff>>8)<<12), clen);
+            if (off+5 > st.st_size) continue; // truncated file
+            if (off+clen > st.st_size) clen = st.st_size-off;
+            region->data[i] = map+off;
             region->len[i] = clen;
+            region->loc[i] = choff;
         }
     }
 
-    lh_free(buf);
     return region;
 }
 
+// copy all chunk data out of the file mapping and release it - this is
+// needed before the region file is overwritten
+void anvil_detach(mca *region) {
+    if (!region->map) return;
+
+    int i;
+    for(i=0; i<REGCHUNKS; i++) {
+        if (!anvil_mapped(region, region->data[i])) continue;
+        uint8_t *data;
+        lh_alloc_buf(data, region->len[i]);
+        memmove(data, region->data[i], region->len[i]);
+        region->data[i] = data;
+    }
+
+    munmap(region->map, region->mapsize);
+    region->map = NULL;
+    region->mapsize = 0;
+}
+
 // save a region to disk
 ssize_t anvil_save(mca *region, const char *path) {
+    // the region may be saved over the file it was loaded from
+    anvil_detach(region);
+
     // generate chunk table first, looking at chunks availability and length
     uint8_t buf[8192];
     int i;
@@ -86,13 +149,16 @@ ssize_t anvil_save(mca *region, const char *path) {
     for(i=0; i<REGCHUNKS; i++) {
         if (region->data[i]) {
             int chlen = lh_align(region->len[i], 4096);
-            lh_write_int_be(w, (choff<<8) + (chlen>>12));
+            region->loc[i] = (choff<<8) + (chlen>>12);
+            lh_write_int_be(w, region->loc[i]);
             //printf("Chunk %d (%d,%d), off=%d, len=%d\n", i, i%32, i/32, choff, (chlen>>12));
             choff+=(chlen>>12);
         }
         else {
+            region->loc[i] = 0;
             lh_write_int_be(w, 0);
         }
+        region->dirty[i] = 0;
     }
 
     for(i=0; i<REGCHUNKS; i++)
@@ -119,8 +185,103 @@ ssize_t anvil_save(mca *region, const char *path) {
     return sz;
 }
 
-static uint8_t nbtdata[2<<24]; // static buffer for NBT data
-static uint8_t cdata[2<<22];   // static buffer for compressed data
+// allocate a run of n free sectors, first fit - extends the file if needed
+static int32_t sector_alloc(uint8_t *used, int32_t *nsect, int32_t n) {
+    int32_t i, run = 0;
+    for(i=2; i<*nsect; i++) {
+        run = used[i] ? 0 : run+1;
+        if (run == n) break;
+    }
+    int32_t off = (run == n) ? i-n+1 : *nsect;
+    if (off+n > *nsect) *nsect = off+n;
+    memset(used+off, 1, n);
+    return off;
+}
+
+// write the changed chunks of a region back to the file it was loaded
+// from, leaving the rest of the file untouched. Chunks that still fit
+// their sectors are rewritten in place, others are moved to free sectors
+// or appended. Regions that weren't loaded from a file are saved in full.
+// Returns the number of bytes written or -1 on error
+ssize_t anvil_update(mca *region, const char *path) {
+    if (!region->map) return anvil_save(region, path);
+
+    int fd = open(path, O_RDWR);
+    if (fd<0) return -1;
+
+    // the file may have grown since it was loaded, and the sectors of
+    // chunks truncated at the end of the file still count as used
+    int32_t nsect = region->nsect;
+    struct stat st;
+    if (!fstat(fd, &st)) nsect = MAX(nsect, (st.st_size+4095)>>12);
+
+    int i;
+    for(i=0; i<REGCHUNKS; i++) {
+        int32_t off = region->loc[i]>>8, cnt = region->loc[i]&0xff;
+        if (off >= 2) nsect = MAX(nsect, off+cnt);
+    }
+
+    // map of the sectors in use - the file can grow by at most
+    // the largest possible size of all chunks
+    lh_create_num(uint8_t, used, nsect+REGCHUNKS*255);
+    used[0] = used[1] = 1;
+
+    for(i=0; i<REGCHUNKS; i++) {
+        int32_t off = region->loc[i]>>8, cnt = region->loc[i]&0xff;
+        if (off >= 2) memset(used+off, 1, cnt);
+    }
+
+    static const uint8_t zero[4096];
+    ssize_t sz = 0;
+
+    for(i=0; i<REGCHUNKS; i++) {
+        if (!region->dirty[i]) continue;
+
+        int32_t off = region->loc[i]>>8, cnt = region->loc[i]&0xff;
+        int32_t need = lh_align(region->len[i], 4096)>>12;
+        if (need > 255) {
+            printf("Chunk %d,%d is too large (%zd bytes), skipping\n",
+                   i&0x1f, i>>5, region->len[i]);
+            continue;
+        }
+
+        if (off >= 2 && cnt >= need) {
+            // fits the current allocation, release the unused tail
+            memset(used+off+need, 0, cnt-need);
+        }
+        else {
+            if (off >= 2) memset(used+off, 0, cnt);
+            off = sector_alloc(used, &nsect, need);
+        }
+
+        // write the chunk data padded to whole sectors
+        ssize_t pos = (ssize_t)off<<12;
+        ssize_t pad = ((ssize_t)need<<12) - region->len[i];
+        if (pwrite(fd, region->data[i], region->len[i], pos) != region->len[i] ||
+            (pad && pwrite(fd, zero, pad, pos+region->len[i]) != pad)) {
+            close(fd);
+            lh_free(used);
+            return -1;
+        }
+        sz += (ssize_t)need<<12;
+
+        // update the location and timestamp in the header
+        region->loc[i] = (off<<8)|need;
+        uint8_t hdr[4], *w;
+        w = hdr; lh_write_int_be(w, region->loc[i]);
+        pwrite(fd, hdr, 4, i*4);
+        w = hdr; lh_write_int_be(w, region->ts[i]);
+        pwrite(fd, hdr, 4, 4096+i*4);
+        sz += 8;
+
+        region->dirty[i] = 0;
+    }
+
+    region->nsect = nsect;
+    close(fd);
+    lh_free(used);
+    return sz;
+}
 
 // return decoded NBT data of a chunk from the region
 nbt_t * anvil_get_chunk(mca * region, int32_t X, int32_t Z) {
@@ -133,42 +294,66 @@ nbt_t * anvil_get_chunk(mca * region, int32_t X, int32_t Z) {
     // parse chunk header
     uint8_t *p = region->data[idx];
     uint32_t len = lh_read_int_be(p)-1;
-    assert(region->len[idx]>=len+5);
     uint8_t ctype = lh_read_char(p);
-    assert(ctype==1 || ctype==2);
+    if (region->len[idx]<(ssize_t)len+5 || (ctype!=1 && ctype!=2)) {
+        printf("Invalid chunk data at %d,%d\n", X, Z);
+        return NULL;
+    }
 
+    // decode into a buffer of the chunk's own size, so chunks can be read
+    // from several threads. The arrays are copied into the tree's arena,
+    // so the buffer is not needed after parsing
     ssize_t dlen;
-    if (ctype==1)
-        dlen = lh_gzip_decode_to(p, len, nbtdata, sizeof(nbtdata));
-    else
-        dlen = lh_zlib_decode_to(p, len, nbtdata, sizeof(nbtdata));
+    uint8_t *data = (ctype==1) ? lh_gzip_decode(p, len, &dlen) : lh_zlib_decode(p, len, &dlen);
+    if (!data) {
+        printf("Failed to decode chunk data at %d,%d\n", X, Z);
+        return NULL;
+    }
 
-    p = nbtdata;
-    nbt_t * nbt = nbt_parse(&p);
+    p = data;
+    nbt_t * nbt = nbt_parse_ex(&p, NBT_ARENA);
+    lh_free(data);
 
     return nbt;
 }
 
-// add a chunk in NBT form to the region
-void anvil_insert_chunk(mca * region, int32_t X, int32_t Z, nbt_t *nbt) {
-    // chunk index in the region - we can accept local and global coordinates
-    int idx = (X&0x1f)+((Z&0x1f)<<5);
+// store compressed chunk data in the region, takes ownership of cdata
+static void anvil_store(mca * region, int idx, uint8_t *cdata, ssize_t clen) {
+    // keep the chunk if its data did not change
+    uint8_t *p = region->data[idx];
+    if (p && region->len[idx] >= clen+5 && lh_read_int_be(p) == clen+1 &&
+        lh_read_char(p) == 2 && !memcmp(p, cdata, clen)) {
+        lh_free(cdata);
+        return;
+    }
 
     // chunk is available - delete it
-    lh_free(region->data[idx]);
-
-    // serialize and compress chunk NBT
-    uint8_t *w = nbtdata;
-    nbt_write(&w, nbt);
-    ssize_t clen = lh_zlib_encode_to(nbtdata, w-nbtdata, cdata, sizeof(cdata));
+    anvil_release(region, idx);
 
     // store it in the region
     region->data[idx] = malloc(clen+5);
     region->len[idx]  = clen+5;
-    w = region->data[idx];
+    uint8_t *w = region->data[idx];
     lh_write_int_be(w, (uint32_t)clen+1);
     lh_write_char(w, 2);
     memmove(w, cdata, clen);
+    lh_free(cdata);
+
+    region->dirty[idx] = 1;
+    region->ts[idx] = time(NULL);
+}
+
+// add a chunk in NBT form to the region
+void anvil_insert_chunk(mca * region, int32_t X, int32_t Z, nbt_t *nbt) {
+    // chunk index in the region - we can accept local and global coordinates
+    int idx = (X&0x1f)+((Z&0x1f)<<5);
+
+    // serialize and compress chunk NBT
+    ssize_t clen;
+    uint8_t *cdata = nbt_compress(nbt, 0, &clen);
+    assert(cdata);
+
+    anvil_store(region, idx, cdata, clen);
 }
 
 nbt_t * anvil_tile_entities(gschunk * ch) {
@@ -249,3 +434,248 @@ nbt_t * anvil_chunk_create(gschunk * ch, int X, int Z) {
 
     return chunk;
 }
+
+////////////////////////////////////////////////////////////////////////////////
+// direct chunk encoder
+
+// Serializes a gschunk straight into the NBT layout produced by
+// anvil_chunk_create, without building the tree
+
+// maximum serialized size of a section, including the tag headers
+#define SECTION_MAXLEN (4096+3*2048+128)
+
+static inline void put_tag(uint8_t **w, int type, const char *name) {
+    ssize_t n = strlen(name);
+    lh_write_char(*w, type);
+    lh_write_short_be(*w, n);
+    memmove(*w, name, n);
+    *w += n;
+}
+
+static inline void put_bytes(uint8_t **w, const char *name, const void *data, int32_t n) {
+    put_tag(w, NBT_BYTE_ARRAY, name);
+    lh_write_int_be(*w, n);
+    memmove(*w, data, n);
+    *w += n;
+}
+
+// split the block IDs and nibble-packed metas of a section
+static void pack_section(const bid_t *bl, uint8_t *blocks, uint8_t *data) {
+    int i=0;
+#ifdef __SSE2__
+    const __m128i lo8 = _mm_set1_epi16(0xff);
+    const __m128i lo4 = _mm_set1_epi16(0x0f);
+    const __m128i lo8d = _mm_set1_epi32(0xff);
+    for(; i<4096; i+=16) {
+        __m128i v0 = _mm_loadu_si128((const __m128i *)(bl+i));
+        __m128i v1 = _mm_loadu_si128((const __m128i *)(bl+i+8));
+
+        // low 8 bits of the block IDs
+        __m128i b0 = _mm_and_si128(_mm_srli_epi16(v0, 4), lo8);
+        __m128i b1 = _mm_and_si128(_mm_srli_epi16(v1, 4), lo8);
+        _mm_storeu_si128((__m128i *)(blocks+i), _mm_packus_epi16(b0, b1));
+
+        // metas - combine each pair of 16-bit lanes into one byte
+        __m128i m0 = _mm_and_si128(v0, lo4);
+        __m128i m1 = _mm_and_si128(v1, lo4);
+        m0 = _mm_and_si128(_mm_or_si128(m0, _mm_srli_epi32(m0, 12)), lo8d);
+        m1 = _mm_and_si128(_mm_or_si128(m1, _mm_srli_epi32(m1, 12)), lo8d);
+        __m128i m = _mm_packs_epi32(m0, m1);
+        _mm_storel_epi64((__m128i *)(data+i/2), _mm_packus_epi16(m, m));
+    }
+#endif
+    for(; i<4096; i+=2) {
+        blocks[i]   = bl[i].bid;
+        blocks[i+1] = bl[i+1].bid;
+        data[i/2]   = bl[i].meta | (bl[i+1].meta<<4);
+    }
+}
+
+// serialize the chunk NBT into an allocated buffer, returns its length
+static ssize_t anvil_chunk_serialize(gschunk * ch, int X, int Z, uint8_t **buf) {
+    int y,i;
+
+    // sections that have any blocks
+    uint16_t mask = 0;
+    for(y=0; y<16; y++) {
+        const uint16_t *raw = &ch->blocks[y<<12].raw;
+        for(i=0; i<4096; i++)
+            if (raw[i]>>4) break;
+        if (i<4096) mask |= (1<<y);
+    }
+
+    // height map - scan each column down from the top non-empty section
+    int32_t hmap[256];
+    lh_clear_obj(hmap);
+    int ytop = 0;
+    for(y=15; y>=0; y--)
+        if (mask&(1<<y)) { ytop = y*16+15; break; }
+    if (mask) {
+        for(i=0; i<256; i++) {
+            for(y=ytop; y>0; y--)
+                if (ch->blocks[i+(y<<8)].bid) break;
+            hmap[i] = y;
+        }
+    }
+
+    int nsec = 0;
+    for(y=0; y<16; y++)
+        if (mask&(1<<y)) nsec++;
+
+    ssize_t size = 1024 + nsec*SECTION_MAXLEN + 4*256 + 256;
+    if (ch->tent) size += nbt_size(ch->tent);
+    lh_alloc_buf(*buf, size);
+    uint8_t *w = *buf;
+
+    put_tag(&w, NBT_COMPOUND, "");
+    put_tag(&w, NBT_COMPOUND, "Level");
+
+    put_tag(&w, NBT_BYTE, "LightPopulated");
+    lh_write_char(w, 0);
+    put_tag(&w, NBT_INT, "zPos");
+    lh_write_int_be(w, Z);
+
+    put_tag(&w, NBT_INT_ARRAY, "HeightMap");
+    lh_write_int_be(w, 256);
+    for(i=0; i<256; i++)
+        lh_write_int_be(w, hmap[i]);
+
+    // Block data
+    put_tag(&w, NBT_LIST, "Sections");
+    lh_write_char(w, nsec ? NBT_COMPOUND : NBT_END);
+    lh_write_int_be(w, nsec);
+
+    for(y=0; y<16; y++) {
+        if (!(mask&(1<<y))) continue;
+
+        uint8_t blocks[4096];
+        uint8_t data[2048];
+        pack_section(ch->blocks+(y<<12), blocks, data);
+
+        put_bytes(&w, "Blocks", blocks, 4096);
+        put_bytes(&w, "SkyLight", ch->skylight+(y<<11), 2048);
+        put_tag(&w, NBT_BYTE, "Y");
+        lh_write_char(w, y);
+        put_bytes(&w, "BlockLight", ch->light+(y<<11), 2048);
+        put_bytes(&w, "Data", data, 2048);
+        lh_write_char(w, NBT_END);
+    }
+
+    put_tag(&w, NBT_LONG, "LastUpdate");
+    lh_write_long_be(w, 1240000000); //TODO: adjust timestamp
+    put_bytes(&w, "Biomes", ch->biome, 256);
+    put_tag(&w, NBT_LONG, "InhabitedTime");
+    lh_write_long_be(w, 0);
+    put_tag(&w, NBT_INT, "xPos");
+    lh_write_int_be(w, X);
+    put_tag(&w, NBT_BYTE, "TerrainPopulated");
+    lh_write_char(w, 1);
+
+    if (ch->tent) {
+        nbt_write(&w, ch->tent);
+    }
+    else {
+        put_tag(&w, NBT_LIST, "TileEntities");
+        lh_write_char(w, NBT_END);
+        lh_write_int_be(w, 0);
+    }
+
+    // TODO: export entities
+    put_tag(&w, NBT_LIST, "Entities");
+    lh_write_char(w, NBT_END);
+    lh_write_int_be(w, 0);
+
+    lh_write_char(w, NBT_END); // Level
+
+    put_tag(&w, NBT_INT, "DataVersion");
+    lh_write_int_be(w, 512);
+    lh_write_char(w, NBT_END);
+
+    assert(w-*buf <= size);
+    return w-*buf;
+}
+
+// add a chunk to the region directly from chunk_t data - equivalent to
+// anvil_insert_chunk with the NBT from anvil_chunk_create
+void anvil_insert_gschunk(mca * region, int32_t X, int32_t Z, gschunk * ch) {
+    int idx = (X&0x1f)+((Z&0x1f)<<5);
+
+    uint8_t *buf;
+    ssize_t len = anvil_chunk_serialize(ch, X, Z, &buf);
+
+    uLongf clen = compressBound(len);
+    uint8_t *cdata;
+    lh_alloc_buf(cdata, clen);
+    int res = compress2(cdata, &clen, buf, len, Z_DEFAULT_COMPRESSION);
+    assert(res == Z_OK);
+    lh_free(buf);
+
+    anvil_store(region, idx, cdata, clen);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// chunk import
+
+// decode chunk NBT (as returned by anvil_get_chunk) into gschunk data
+// returns 0 on success, -1 if the NBT is not a valid chunk
+int anvil_chunk_import(nbt_t *nbt, gschunk *gc) {
+    nbt_t *level = nbt_hget(nbt, "Level");
+    nbt_t *sections = nbt_hget(level, "Sections");
+    if (!sections || sections->type != NBT_LIST) return -1;
+
+    memset(gc->blocks,   0, sizeof(gc->blocks));
+    memset(gc->light,    0, sizeof(gc->light));
+    memset(gc->skylight, 0, sizeof(gc->skylight));
+
+    int s,i;
+    for(s=0; s<sections->count; s++) {
+        nbt_t *sec = nbt_aget(sections, s);
+        nbt_t *Y          = nbt_hget(sec, "Y");
+        nbt_t *Blocks     = nbt_hget(sec, "Blocks");
+        nbt_t *Add        = nbt_hget(sec, "Add");
+        nbt_t *Data       = nbt_hget(sec, "Data");
+        nbt_t *BlockLight = nbt_hget(sec, "BlockLight");
+        nbt_t *SkyLight   = nbt_hget(sec, "SkyLight");
+
+        if (!Y || Y->b<0 || Y->b>15) continue;
+        if (!Blocks || Blocks->count != 4096) continue;
+        int y = Y->b;
+
+        bid_t *bl = gc->blocks+(y<<12);
+        uint8_t *blocks = (uint8_t *)Blocks->ba;
+        uint8_t *add  = (Add  && Add->count==2048)  ? (uint8_t *)Add->ba  : NULL;
+        uint8_t *data = (Data && Data->count==2048) ? (uint8_t *)Data->ba : NULL;
+
+        for(i=0; i<4096; i++) {
+            int sh = (i&1)<<2;
+            bl[i].bid  = blocks[i] | (add ? ((add[i>>1]>>sh)&15)<<8 : 0);
+            bl[i].meta = data ? (data[i>>1]>>sh)&15 : 0;
+        }
+
+        if (BlockLight && BlockLight->count==2048)
+            memmove(gc->light+(y<<11), BlockLight->ba, 2048);
+        if (SkyLight && SkyLight->count==2048)
+            memmove(gc->skylight+(y<<11), SkyLight->ba, 2048);
+    }
+
+    nbt_t *biomes = nbt_hget(level, "Biomes");
+    if (biomes && biomes->type == NBT_BYTE_ARRAY && biomes->count == 256)
+        memmove(gc->biome, biomes->ba, 256);
+
+    nbt_free(gc->tent);
+    gc->tent = NULL;
+    nbt_t *tent = nbt_hget(level, "TileEntities");
+    if (tent && tent->type == NBT_LIST && tent->count > 0)
+        gc->tent = nbt_clone(tent);
+
+    return 0;
+}
+
+// read a chunk from the region into a gschunk, returns 0 on success
+int anvil_import_gschunk(mca * region, int32_t X, int32_t Z, gschunk * gc) {
+    nbt_t *nbt = anvil_get_chunk(region, X, Z);
+    if (!nbt) return -1;
+    int res = anvil_chunk_import(nbt, gc);
+    nbt_free(nbt);
+    return res;
+}
@@ -8,9 +8,19 @@
 #define REGCHUNKS (32*32)
 
 typedef struct {
-    uint8_t   * data[REGCHUNKS];    // compressed chunk data
+    uint8_t   * data[REGCHUNKS];    // compressed chunk data - either allocated
+                                    // or pointing into the file mapping
     ssize_t     len[REGCHUNKS];     // size of each chunk's data
     uint32_t    ts[REGCHUNKS];      // chunk timestamps
+
+    uint8_t   * map;                // mapping of the region file, if loaded
+    ssize_t     mapsize;
+    int32_t     nsect;              // size of the file in sectors, including
+                                    // the ones appended by anvil_update
+
+    uint32_t    loc[REGCHUNKS];     // chunk locations in the file, in header
+                                    // format: sector offset<<8 | sector count
+    uint8_t     dirty[REGCHUNKS];   // chunk was changed since loading/saving
 } mca;
 
 mca *   anvil_create();
@@ -18,9 +28,15 @@ void    anvil_free(mca * region);
 void    anvil_dump(mca * region);
 
 mca *   anvil_load(const char *path);
+void    anvil_detach(mca *region);
 ssize_t anvil_save(mca *region, const char *path);
+ssize_t anvil_update(mca *region, const char *path);
 
 nbt_t * anvil_get_chunk(mca * region, int32_t X, int32_t Z);
 void    anvil_insert_chunk(mca * region, int32_t X, int32_t Z, nbt_t *nbt);
 
 nbt_t * anvil_chunk_create(gschunk * ch, int X, int Z);
+void    anvil_insert_gschunk(mca * region, int32_t X, int32_t Z, gschunk * ch);
+
+int     anvil_chunk_import(nbt_t *nbt, gschunk *gc);
+int     anvil_import_gschunk(mca * region, int32_t X, int32_t Z, gschunk * gc);
@@ -0,0 +1,126 @@
+/*
+ Authors:
+ Copyright 2012-2016 by Eduard Broese <ed.broese@gmx.de>
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version
+ 2 of the License, or (at your option) any later version.
+*/
+
+/*
+  bench_aes : AES-128-CFB8 benchmark, legacy AES API against aes_stream
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <openssl/aes.h>
+
+#include <lh_buffers.h>
+
+#include "aes.h"
+#include "helpers.h"
+
+#define MINTIME 500000      // run each test for at least this many microseconds
+#define BUFSIZE (4<<20)     // data encrypted per pass
+#define CHUNK   16384       // bytes per call, about one socket read
+
+////////////////////////////////////////////////////////////////////////////////
+
+typedef struct {
+    AES_KEY aes;
+    uint8_t iv[16];
+} legacy;
+
+static void legacy_init(legacy *l, const uint8_t *key) {
+    AES_set_encrypt_key(key, 128, &l->aes);
+    memmove(l->iv, key, 16);
+}
+
+static void legacy_run(legacy *l, uint8_t *src, uint8_t *dst, ssize_t len, int enc) {
+    int num = 0;
+    AES_cfb8_encrypt(src, dst, len, &l->aes, l->iv, &num, enc ? AES_ENCRYPT : AES_DECRYPT);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+#define M_LEGACY_ENC    0
+#define M_LEGACY_DEC    1
+#define M_EVP_ENC       2
+#define M_EVP_DEC       3
+
+static const char * mnames[] = {
+    "AES_cfb8_encrypt encrypt",
+    "AES_cfb8_encrypt decrypt",
+    "aes_encrypt (EVP CFB8)",
+    "aes_decrypt (batched ECB)",
+};
+
+// process the buffer in CHUNK-sized calls until MINTIME has passed,
+// returns the throughput in MB/s
+static double bench(int m, const uint8_t *key, uint8_t *src, uint8_t *dst) {
+    legacy l;
+    aes_stream as; CLEAR(as);
+    if (m <= M_LEGACY_DEC)
+        legacy_init(&l, key);
+    else
+        aes_stream_init(&as, key, m==M_EVP_DEC);
+
+    uint64_t t0 = gettimestamp(), t;
+    int64_t n = 0;
+    do {
+        ssize_t off;
+        for(off=0; off<BUFSIZE; off+=CHUNK) {
+            switch (m) {
+                case M_LEGACY_ENC: legacy_run(&l, src+off, dst+off, CHUNK, 1); break;
+                case M_LEGACY_DEC: legacy_run(&l, src+off, dst+off, CHUNK, 0); break;
+                case M_EVP_ENC:    aes_encrypt(&as, src+off, dst+off, CHUNK); break;
+                case M_EVP_DEC:    aes_decrypt(&as, src+off, dst+off, CHUNK); break;
+            }
+        }
+        n += BUFSIZE;
+        t = gettimestamp()-t0;
+    } while (t < MINTIME);
+
+    aes_stream_free(&as);
+    return (double)n/t;
+}
+
+int main(int ac, char **av) {
+    uint8_t key[16];
+    int i;
+    for(i=0; i<16; i++) key[i] = rand();
+
+    lh_create_num(uint8_t, plain, BUFSIZE);
+    lh_create_num(uint8_t, cipher, BUFSIZE);
+    lh_create_num(uint8_t, out, BUFSIZE);
+    for(i=0; i<BUFSIZE; i++) plain[i] = rand();
+
+    // check that both implementations produce the same stream, in a single
+    // pass so the IV is the same for both
+    legacy l; legacy_init(&l, key);
+    legacy_run(&l, plain, cipher, BUFSIZE, 1);
+
+    aes_stream as; CLEAR(as);
+    aes_stream_init(&as, key, 0);
+    aes_encrypt(&as, plain, out, BUFSIZE);
+    if (memcmp(cipher, out, BUFSIZE)) printf("aes_encrypt: output differs\n");
+
+    aes_stream_init(&as, key, 1);
+    aes_decrypt(&as, cipher, out, BUFSIZE);
+    if (memcmp(plain, out, BUFSIZE)) printf("aes_decrypt: output differs\n");
+    aes_stream_free(&as);
+
+    int m;
+    for(m=M_LEGACY_ENC; m<=M_EVP_DEC; m++) {
+        uint8_t *src = (m==M_LEGACY_DEC || m==M_EVP_DEC) ? cipher : plain;
+        printf("%-28s %9.1f MB/s\n", mnames[m], bench(m, key, src, out));
+    }
+
+    lh_free(plain);
+    lh_free(cipher);
+    lh_free(out);
+    return 0;
+}
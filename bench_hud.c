@@ -0,0 +1,127 @@
+/*
+ Authors:
+ Copyright 2012-2016 by Eduard Broese <ed.broese@gmx.de>
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version
+ 2 of the License, or (at your option) any later version.
+*/
+
+/*
+  bench_hud : HUD rendering benchmark
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <lh_buffers.h>
+
+#include "mcp_ids.h"
+#include "mcp_gamestate.h"
+#include "hud.h"
+#include "helpers.h"
+
+#define FRAMES  10000   // frames rendered for each page
+#define RADIUS  6       // chunks generated around the player
+
+// provided by mcproxy
+void drop_connection() {}
+ssize_t client_backlog() { return 0; }
+
+////////////////////////////////////////////////////////////////////////////////
+
+// rolling terrain with a few tunnels, so the map and the tunnel radar
+// have something to show
+static void gen_world() {
+    int32_t X,Z,x,z,y;
+    for(X=-RADIUS; X<RADIUS; X++) {
+        for(Z=-RADIUS; Z<RADIUS; Z++) {
+            gschunk *gc = find_chunk(gs.world, X, Z, 1);
+            for(z=0; z<16; z++) {
+                for(x=0; x<16; x++) {
+                    int32_t wx = X*16+x, wz = Z*16+z;
+                    int32_t h = 60+((wx*7+wz*13)>>3)%8;
+                    for(y=0; y<=h; y++) {
+                        bid_t b = (y<h-3) ? BLOCKTYPE(1,0) : (y<h) ? BLOCKTYPE(3,0) : BLOCKTYPE(2,0);
+                        if (y>=62 && y<=64 && (wx%12==0 || wz%16==0)) b = BLOCKTYPE(0,0);
+                        gc->blocks[(y<<8)|(z<<4)|x] = b;
+                    }
+                }
+            }
+        }
+    }
+}
+
+// a player walking in the generated area with a few items in the inventory
+static void gen_player() {
+    gs.own.x = 0.5;
+    gs.own.y = 64;
+    gs.own.z = 0.5;
+    gs.own.health = 20;
+    gs.own.food = 20;
+    gs.own.saturation = 5;
+
+    int i;
+    for(i=36; i<45; i++) {
+        gs.inv.slots[i].item = 1+i-36;
+        gs.inv.slots[i].count = 64;
+    }
+}
+
+// move the player by one block along a square path
+static void step_player(int frame) {
+    int side = (frame/32)%4;
+    gs.own.x += (side==0) - (side==2);
+    gs.own.z += (side==1) - (side==3);
+    gs.own.yaw = side*90;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static const struct {
+    const char *name;
+    int         mode;
+    int         moving;     // the player moves between the frames
+} pages[] = {
+    { "test",   HUDMODE_TEST,   0 },
+    { "info",   HUDMODE_INFO,   1 },
+    { "tunnel", HUDMODE_TUNNEL, 1 },
+    { "map",    HUDMODE_MAP,    0 },
+    { "map",    HUDMODE_MAP,    1 },
+    { "build",  HUDMODE_BUILD,  0 },
+    { "help",   HUDMODE_HELP,   0 },
+    { NULL, 0, 0 },
+};
+
+int main(int ac, char **av) {
+    gs_reset();
+    gs.world = &gs.overworld;
+    gen_world();
+    gen_player();
+
+    // loads the fonts
+    char reply[256];
+    if (hud_bind(reply, 0) < 0) {
+        printf("%s\n", reply);
+        return 1;
+    }
+
+    int p,i;
+    for(p=0; pages[p].name; p++) {
+        uint64_t t0 = gettimestamp();
+        for(i=0; i<FRAMES; i++) {
+            if (pages[p].moving) step_player(i);
+            hud_invalidate(HUDINV_ANY);
+            hud_draw(pages[p].mode);
+        }
+        uint64_t t = gettimestamp()-t0;
+
+        printf("%-8s %-10s %8.2f us/frame\n", pages[p].name,
+               pages[p].moving ? "moving" : "stationary", (double)t/FRAMES);
+    }
+
+    gs_destroy();
+    return 0;
+}
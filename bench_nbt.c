@@ -0,0 +1,233 @@
+/*
+ Authors:
+ Copyright 2012-2016 by Eduard Broese <ed.broese@gmx.de>
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version
+ 2 of the License, or (at your option) any later version.
+*/
+
+/*
+  bench_nbt : NBT parser and name lookup benchmark
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <lh_buffers.h>
+#include <lh_files.h>
+#include <lh_compress.h>
+
+#include "nbt.h"
+#include "helpers.h"
+
+#define MINTIME 500000  // run each test for at least this many microseconds
+
+////////////////////////////////////////////////////////////////////////////////
+
+// load an NBT file, decompressing it if it's gzipped
+static uint8_t * load_nbt(const char *path, ssize_t *len) {
+    uint8_t *data;
+    ssize_t sz = lh_load_alloc(path, &data);
+    if (sz < 0) {
+        printf("Failed to load %s\n", path);
+        return NULL;
+    }
+
+    if (sz>2 && data[0]==0x1f && data[1]==0x8b) {
+        uint8_t *udata = lh_gzip_decode(data, sz, len);
+        lh_free(data);
+        return udata;
+    }
+
+    *len = sz;
+    return data;
+}
+
+// a schematic with random blocks, large enough to make the array copies count
+static uint8_t * gen_schematic(int wd, int hg, int ln, ssize_t *len) {
+    int32_t i, size = wd*hg*ln;
+    lh_create_num(uint8_t,blocks,size);
+    lh_create_num(uint8_t,data,size);
+    for(i=0; i<size; i++) {
+        blocks[i] = (i%7) ? rand()&0xff : 0;
+        data[i]   = rand()&0x0f;
+    }
+
+    nbt_t * Schematic = nbt_new(NBT_COMPOUND, "Schematic", 8,
+        nbt_new(NBT_SHORT, "Height", hg),
+        nbt_new(NBT_SHORT, "Length", ln),
+        nbt_new(NBT_SHORT, "Width", wd),
+        nbt_new(NBT_STRING, "Materials", "Alpha"),
+        nbt_new(NBT_LIST, "Entities", 0),
+        nbt_new(NBT_LIST, "TileEntities", 0),
+        nbt_new(NBT_BYTE_ARRAY, "Blocks", blocks, size),
+        nbt_new(NBT_BYTE_ARRAY, "Data", data, size));
+
+    uint8_t *buf = nbt_serialize(Schematic, len);
+    nbt_free(Schematic);
+    return buf;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static const struct {
+    const char *name;
+    int         flags;      // -1 for the nbt_parse
+} modes[] = {
+    { "tree",  -1 },
+    { "arena", NBT_ARENA },
+    { "view",  NBT_VIEW },
+    { NULL, 0 },
+};
+
+// parse and free the data repeatedly in each of the modes
+static void bench_parse(const char *name, uint8_t *data, ssize_t len) {
+    int m;
+    for(m=0; modes[m].name; m++) {
+        uint64_t t0 = gettimestamp(), t;
+        int n = 0;
+        do {
+            uint8_t *p = data;
+            nbt_t *nbt = (modes[m].flags<0) ? nbt_parse(&p) : nbt_parse_ex(&p, modes[m].flags);
+            if (!nbt) {
+                printf("%s: failed to parse\n", name);
+                return;
+            }
+            nbt_free(nbt);
+            n++;
+            t = gettimestamp()-t0;
+        } while (t < MINTIME);
+
+        printf("%-32s %-6s %8zd bytes %10.2f us/parse %9.1f MB/s\n",
+               name, modes[m].name, len, (double)t/n, (double)len*n/t);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static const char *level_keys[] = {
+    "xPos", "zPos", "LastUpdate", "InhabitedTime", "LightPopulated",
+    "TerrainPopulated", "V", "Biomes", "HeightMap", "Sections", "Entities",
+    "TileTicks", NULL
+};
+
+static const char *tent_keys[] = {
+    "id", "x", "y", "z", "Items", "CustomName", "Lock", "LootTable",
+    "LootTableSeed", NULL
+};
+
+// a compound with the given element names, followed by generated
+// names up to n elements
+static nbt_t * gen_compound(const char *name, const char **keys, int n) {
+    nbt_t *co = nbt_new(NBT_COMPOUND, name, 0);
+    int i;
+    for(i=0; i<n; i++) {
+        char kname[64];
+        if (keys && keys[i]) {
+            sprintf(kname, "%s", keys[i]);
+        }
+        else {
+            keys = NULL;
+            sprintf(kname, "ForgeData_%d", i);
+        }
+        nbt_add(co, nbt_new(NBT_INT, kname, i));
+    }
+    return co;
+}
+
+// a chunk with a TileEntities list, as stored in the Anvil files
+static nbt_t * gen_chunk(int ntent) {
+    nbt_t *level = gen_compound("Level", level_keys, 12);
+    nbt_t *tents = nbt_new(NBT_LIST, "TileEntities", 0);
+    int i;
+    for(i=0; i<ntent; i++)
+        nbt_add(tents, gen_compound(NULL, tent_keys, 9));
+    nbt_add(level, tents);
+    return nbt_new(NBT_COMPOUND, "", 1, level);
+}
+
+// nbt_hget without the name index
+static nbt_t * linear_get(nbt_t *nbt, const char *name) {
+    int i;
+    for(i=0; i<nbt->count; i++) {
+        const char *elname = nbt->co[i]->name;
+        if (elname && !strcmp(elname, name))
+            return nbt->co[i];
+    }
+    return NULL;
+}
+
+// look up each of the compound's element names and a missing one in turn
+static void bench_lookup(const char *name, nbt_t *co) {
+    lh_create_num(const char *, names, co->count+1);
+    int i, nn = co->count+1;
+    for(i=0; i<co->count; i++)
+        names[i] = co->co[i]->name;
+    names[co->count] = "NoSuchElement";
+
+    double linear = 0, indexed = 0;
+    int m;
+    for(m=0; m<2; m++) {
+        uint64_t t0 = gettimestamp(), t;
+        int n = 0, found = 0;
+        do {
+            for(i=0; i<nn; i++)
+                found += (m ? nbt_hget(co, names[i]) : linear_get(co, names[i])) != NULL;
+            n += nn;
+            t = gettimestamp()-t0;
+        } while (t < MINTIME);
+        if (found != n/nn*(nn-1)) printf("%s: lookup mismatch\n", name);
+        *(m ? &indexed : &linear) = t*1000.0/n;
+    }
+
+    printf("%-32s %5zd elements %8.1f ns/lookup linear %8.1f ns/lookup indexed\n",
+           name, co->count, linear, indexed);
+    lh_free(names);
+}
+
+int main(int ac, char **av) {
+    // bigtest.nbt, the sample schematic and any files given as arguments
+    const char *def[] = { "bigtest.nbt", "schematic/kizhi_pogost.schematic", NULL };
+    const char **files = (ac>1) ? (const char **)av+1 : def;
+
+    int i;
+    for(i=0; files[i]; i++) {
+        ssize_t len;
+        uint8_t *data = load_nbt(files[i], &len);
+        if (!data) continue;
+        bench_parse(files[i], data, len);
+        lh_free(data);
+    }
+
+    ssize_t len;
+    uint8_t *data = gen_schematic(256, 128, 256, &len);
+    bench_parse("generated 256x128x256 schematic", data, len);
+    lh_free(data);
+
+    // name lookups in a chunk parsed into an arena, where the index is
+    // built during parsing, and in large compounds indexed on first use
+    nbt_t *chunk = gen_chunk(64);
+    data = nbt_serialize(chunk, &len);
+    nbt_free(chunk);
+    uint8_t *p = data;
+    chunk = nbt_parse_ex(&p, NBT_ARENA);
+    nbt_t *level = nbt_hget(chunk, "Level");
+    bench_lookup("chunk Level", level);
+    bench_lookup("chunk TileEntities[0]", nbt_aget(nbt_hget(level, "TileEntities"), 0));
+    nbt_free(chunk);
+    lh_free(data);
+
+    int sizes[] = { 40, 300, 4000, 0 };
+    for(i=0; sizes[i]; i++) {
+        char name[64];
+        sprintf(name, "generated Level, %d elements", sizes[i]);
+        nbt_t *co = gen_compound("Level", level_keys, sizes[i]);
+        bench_lookup(name, co);
+        nbt_free(co);
+    }
+
+    return 0;
+}
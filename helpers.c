@@ -53,3 +53,84 @@ int tb_event(tokenbucket *tb, uint64_t size) {
     return size;
 }
 
+
+// timestamp at which the bucket will allow an event of this size
+uint64_t tb_due(tokenbucket *tb, uint64_t size) {
+    if (tb->level >= size) return tb->last;
+    return tb->last + (size-tb->level)*tb->interval;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Timer wheel
+
+// timers are hashed into slots by their deadline tick; timers further than
+// one revolution ahead share the slots and are simply skipped until due
+
+void tw_arm(timerwheel *tw, twtimer *t, uint64_t due) {
+    tw_disarm(t);
+
+    // a deadline in the past will be handled on the next pass
+    uint64_t tick = ((due>tw->now) ? due : tw->now)/TW_TICK;
+    twtimer **s = &tw->slot[tick%TW_SLOTS];
+
+    t->due = due ? due : 1;
+    t->next = *s;
+    t->pprev = s;
+    if (*s) (*s)->pprev = &t->next;
+    *s = t;
+}
+
+void tw_disarm(twtimer *t) {
+    if (!t->due) return;
+    *t->pprev = t->next;
+    if (t->next) t->next->pprev = t->pprev;
+    t->due = 0;
+    t->next = NULL;
+    t->pprev = NULL;
+}
+
+// remove and return one timer that expired by ts, NULL if there are none left
+twtimer * tw_expired(timerwheel *tw, uint64_t ts) {
+    uint64_t tick = tw->now/TW_TICK, last = ts/TW_TICK;
+    if (last-tick >= TW_SLOTS) tick = last-TW_SLOTS+1;
+
+    for(; tick<=last; tick++) {
+        twtimer *t;
+        for(t=tw->slot[tick%TW_SLOTS]; t; t=t->next) {
+            if (t->due > ts) continue;
+            tw->now = tick*TW_TICK;
+            tw_disarm(t);
+            return t;
+        }
+    }
+
+    tw->now = ts;
+    return NULL;
+}
+
+// time until the nearest deadline, in us; -1 if no timers are armed
+int64_t tw_timeout(timerwheel *tw, uint64_t ts) {
+    uint64_t tick = tw->now/TW_TICK, best = 0;
+
+    int i;
+    for(i=0; i<TW_SLOTS; i++, tick++) {
+        uint64_t due = 0;
+        twtimer *t;
+        for(t=tw->slot[tick%TW_SLOTS]; t; t=t->next) {
+            if (t->due/TW_TICK <= tick) {
+                // due within this revolution of the wheel
+                if (!due || t->due < due) due = t->due;
+            }
+            else if (!best || t->due < best) {
+                best = t->due;
+            }
+        }
+        if (due) {
+            best = due;
+            break;
+        }
+    }
+
+    if (!best) return -1;
+    return (best > ts) ? best-ts : 0;
+}
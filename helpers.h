@@ -42,3 +42,26 @@ typedef struct {
 
 tokenbucket * tb_init(tokenbucket *tb, int64_t interval, int64_t burst);
 int tb_event(tokenbucket *tb, uint64_t size);
+uint64_t tb_due(tokenbucket *tb, uint64_t size);
+
+////////////////////////////////////////////////////////////////////////////////
+// Timer wheel
+
+#define TW_SLOTS    256         // number of wheel slots
+#define TW_TICK     1000        // time covered by one slot, in us
+
+typedef struct twtimer {
+    uint64_t         due;       // deadline, in us; 0 if the timer is not armed
+    struct twtimer  *next;      // next timer in the same slot
+    struct twtimer **pprev;     // link pointing to this timer
+} twtimer;
+
+typedef struct {
+    uint64_t    now;            // timestamp up to which the wheel was processed
+    twtimer    *slot[TW_SLOTS];
+} timerwheel;
+
+void      tw_arm(timerwheel *tw, twtimer *t, uint64_t due);
+void      tw_disarm(twtimer *t);
+twtimer * tw_expired(timerwheel *tw, uint64_t ts);
+int64_t   tw_timeout(timerwheel *tw, uint64_t ts);
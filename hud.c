@@ -331,13 +331,6 @@ static int8_t BLOCK_COLORMAP[256][16] = {
 
 ////////////////////////////////////////////////////////////////////////////////
 
-#define HUDMODE_TEST            0
-#define HUDMODE_INFO            1
-#define HUDMODE_TUNNEL          2
-#define HUDMODE_MAP             3
-#define HUDMODE_BUILD           4
-#define HUDMODE_HELP            5
-
 #define DEFAULT_MAP_ID 32767
 
 int hud_mode        = HUDMODE_INFO;
@@ -350,6 +343,11 @@ int hud_build_plan  = 0;
 
 uint8_t hud_image[16384];
 
+// the picture last transmitted to the client, for diffing the next frame
+static uint8_t  hud_last[16384];
+static int      hud_last_valid = 0;
+static uint64_t hud_last_ts = 0;
+
 // TODO: color constants
 uint8_t fg_color    = 119; // Black
 uint8_t bg_color    = 0;   // Transparent
@@ -416,17 +414,6 @@ void draw_line(int c1, int r1, int c2, int r2) {
     }
 }
 
-void draw_glyph(int col, int row, char l) {
-    if (l<0x20 || l>0x7f) return;
-    draw_blit(fonts, (l&15)*font_w, ((l>>4)-2)*font_h+font_o, font_w, font_h, col, row);
-}
-
-void draw_text(int col, int row, char *s) {
-    int i;
-    for(i=0; s[i]; i++)
-        draw_glyph(col+i*FONTS_W, row, s[i]);
-}
-
 void draw_rect(int col, int row, int wd, int hg, int hollow) {
     uint8_t  *hud   = hud_image+col+row*128;
     int c,r;
@@ -442,6 +429,137 @@ void draw_rect(int col, int row, int wd, int hg, int hollow) {
     }
 }
 
+////////////////////////////////////////////////////////////////////////////////
+// Glyph atlas and text layout cache
+
+// a horizontal run of foreground pixels, relative to the glyph or text origin
+typedef struct {
+    uint8_t r, c, n;
+} span_t;
+
+#define GLYPH_MAXSPANS (FONTS_H*((FONTS_W+1)/2))
+
+// glyph mask, run-length encoded from the font image
+typedef struct {
+    int    ns;
+    span_t s[GLYPH_MAXSPANS];
+} glyph_t;
+
+static glyph_t   glyphs[96];
+static lhimage * glyphs_src = NULL;
+
+#define TEXT_MAXLEN 32
+#define TEXT_CACHE  64
+
+// pre-rendered text line - foreground spans sorted by row, and the
+// background spans covering the printable character cells
+typedef struct {
+    char   s[TEXT_MAXLEN+1];
+    int    nfg, nbg;
+    span_t fg[TEXT_MAXLEN*GLYPH_MAXSPANS];
+    span_t bg[TEXT_MAXLEN/2+1];
+} textlayout;
+
+static textlayout text_cache[TEXT_CACHE];
+
+// (re)build the glyph atlas if the fonts image has changed
+static void hud_glyphs() {
+    if (!fonts || glyphs_src == fonts) return;
+
+    int l,r,c;
+    for(l=0x20; l<0x80; l++) {
+        glyph_t *g = &glyphs[l-0x20];
+        g->ns = 0;
+        uint32_t *bm = &IMGDOT(fonts, (l&15)*font_w, ((l>>4)-2)*font_h+font_o);
+        for(r=0; r<FONTS_H; r++) {
+            uint32_t *bmr = bm+r*fonts->stride;
+            for(c=0; c<FONTS_W; c++) {
+                if ((bmr[c]&0xffffff) != 0xffffff) continue;
+                span_t *sp = g->s+g->ns-1;
+                if (g->ns && sp->r==r && sp->c+sp->n==c)
+                    sp->n++;
+                else
+                    g->s[g->ns++] = (span_t){ r, c, 1 };
+            }
+        }
+    }
+    glyphs_src = fonts;
+    memset(text_cache, 0, sizeof(text_cache));
+}
+
+static inline uint32_t text_hash(const char *s) {
+    uint32_t h = 2166136261u;
+    for(; *s; s++) h = (h^(uint8_t)*s)*16777619u;
+    return h;
+}
+
+static void text_layout(textlayout *tl, const char *s, int len) {
+    memmove(tl->s, s, len+1);
+    tl->nfg = tl->nbg = 0;
+
+    int i,j,r;
+    for(i=0; i<len; i++) {
+        if (s[i]<0x20 || s[i]>0x7f) continue;
+        span_t *sp = tl->bg+tl->nbg-1;
+        if (tl->nbg && sp->c+sp->n==i*FONTS_W)
+            sp->n += FONTS_W;
+        else
+            tl->bg[tl->nbg++] = (span_t){ 0, i*FONTS_W, FONTS_W };
+    }
+
+    for(r=0; r<FONTS_H; r++) {
+        for(i=0; i<len; i++) {
+            if (s[i]<0x20 || s[i]>0x7f) continue;
+            glyph_t *g = &glyphs[s[i]-0x20];
+            for(j=0; j<g->ns; j++) {
+                if (g->s[j].r != r) continue;
+                int c = i*FONTS_W+g->s[j].c;
+                span_t *sp = tl->fg+tl->nfg-1;
+                if (tl->nfg && sp->r==r && sp->c+sp->n==c)
+                    sp->n += g->s[j].n;
+                else
+                    tl->fg[tl->nfg++] = (span_t){ r, c, g->s[j].n };
+            }
+        }
+    }
+}
+
+static void draw_spans(span_t *fg, int nfg, span_t *bg, int nbg, int col, int row) {
+    uint8_t *hud = hud_image+col+row*128;
+    int i,r;
+
+    if (bg_color != 0)
+        for(i=0; i<nbg; i++)
+            for(r=0; r<FONTS_H; r++)
+                memset(hud+r*128+bg[i].c, bg_color, bg[i].n);
+
+    for(i=0; i<nfg; i++)
+        memset(hud+fg[i].r*128+fg[i].c, fg_color, fg[i].n);
+}
+
+void draw_glyph(int col, int row, char l) {
+    if (l<0x20 || l>0x7f) return;
+    hud_glyphs();
+    glyph_t *g = &glyphs[l-0x20];
+    span_t bg = { 0, 0, FONTS_W };
+    draw_spans(g->s, g->ns, &bg, 1, col, row);
+}
+
+void draw_text(int col, int row, char *s) {
+    int i, len = strlen(s);
+    if (len > TEXT_MAXLEN) {
+        for(i=0; s[i]; i++)
+            draw_glyph(col+i*FONTS_W, row, s[i]);
+        return;
+    }
+
+    hud_glyphs();
+    textlayout *tl = &text_cache[text_hash(s)%TEXT_CACHE];
+    if (strcmp(tl->s, s))
+        text_layout(tl, s, len);
+    draw_spans(tl->fg, tl->nfg, tl->bg, tl->nbg, col, row);
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 
 void hud_unbind(char *reply, MCPacketQueue *cq);
@@ -498,6 +616,7 @@ int hud_bind(char *reply, int id) {
     }
 
     hud_id = id;
+    hud_last_valid = 0;
     return id;
 }
 
@@ -525,6 +644,7 @@ void hud_unbind(char *reply, MCPacketQueue *cq) {
     }
 
     hud_id = -1;
+    hud_last_valid = 0;
 }
 
 // workaround for bug MC-46345 - renew map ID when changing dimension
@@ -553,6 +673,7 @@ void hud_renew(MCPacketQueue *cq) {
 
     if (hud_id == hud_autoid) hud_id = hud_newid;
     hud_autoid = hud_newid;
+    hud_last_valid = 0;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -806,35 +927,148 @@ int huddraw_info() {
     return 1;
 }
 
-int huddraw_map() {
-    int shading[16] = { 3, 3, 3, 3, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2 };
+////////////////////////////////////////////////////////////////////////////////
+// Map cache
+
+// Top-down colors of the 128x128 columns around the player, kept between
+// the frames. Moving the player shifts the cache and only the newly exposed
+// columns are computed, block and chunk updates mark single columns dirty.
+
+#define MAPC_NONE   -1      // no block in the height range of the column
+#define MAPC_DIRTY  -2      // column needs to be recomputed
+
+struct {
+    int      valid;
+    gsworld *world;         // world the cache was computed for
+    int32_t  x0, z0;        // world coordinates of the pixel 0,0
+    int32_t  y;             // player's y position the cache was computed for
+    int16_t  col[16384];    // map color of each column or one of MAPC_*
+    int16_t  dirty[16384];  // list of the dirty columns
+    int      ndirty;
+} mapc;
+
+static int shading[16] = { 3, 3, 3, 3, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2 };
+
+// compute the color of a single column - topmost block from y-12 to y+3
+static int16_t mapc_column(int32_t x, int32_t z, int32_t y) {
+    gschunk *gc = page_chunk(gs.world, x>>4, z>>4);
+    if (!gc) return MAPC_NONE;
+
+    int j;
+    for(j=15; j>=0; j--) {
+        int32_t by = y-12+j;
+        if (by<0 || by>255) continue;
+        bid_t b = gc->blocks[by*256+(z&15)*16+(x&15)];
+        if (b.bid)
+            return BLOCK_COLORMAP[b.bid][b.meta]*4 + shading[j];
+    }
+    return MAPC_NONE;
+}
 
-    if (!(hud_inv & HUDINVMASK_TUNNEL)) return 0;
+static inline void mapc_mark(int32_t x, int32_t z) {
+    if (!mapc.valid) return;
+    int32_t c = x-mapc.x0, r = z-mapc.z0;
+    if (c<0 || c>=128 || r<0 || r>=128) return;
+    int16_t *p = mapc.col+r*128+c;
+    if (*p == MAPC_DIRTY) return;
+    *p = MAPC_DIRTY;
+    mapc.dirty[mapc.ndirty++] = r*128+c;
+}
+
+// bring the cache to the player's current position
+static void mapc_update(int32_t x, int32_t y, int32_t z) {
+    int32_t x0 = x-64, z0 = z-64;
+    int r,c,i;
+
+    if (!mapc.valid || mapc.world!=gs.world || mapc.y!=y ||
+        abs(x0-mapc.x0)>=128 || abs(z0-mapc.z0)>=128) {
+        // nothing can be reused - compute everything
+        for(r=0; r<128; r++)
+            for(c=0; c<128; c++)
+                mapc.col[r*128+c] = mapc_column(x0+c, z0+r, y);
+    }
+    else if (x0!=mapc.x0 || z0!=mapc.z0) {
+        // shift the cache, compute the columns that came into the view
+        int dc = x0-mapc.x0, dr = z0-mapc.z0;
+        int16_t old[16384];
+        memcpy(old, mapc.col, sizeof(old));
+        for(r=0; r<128; r++) {
+            for(c=0; c<128; c++) {
+                int sr=r+dr, sc=c+dc;
+                if (sr>=0 && sr<128 && sc>=0 && sc<128 && old[sr*128+sc]!=MAPC_DIRTY)
+                    mapc.col[r*128+c] = old[sr*128+sc];
+                else
+                    mapc.col[r*128+c] = mapc_column(x0+c, z0+r, y);
+            }
+        }
+    }
+    else {
+        // same position - only the dirty columns
+        for(i=0; i<mapc.ndirty; i++) {
+            int p = mapc.dirty[i];
+            mapc.col[p] = mapc_column(x0+(p&127), z0+(p>>7), y);
+        }
+    }
+
+    mapc.ndirty = 0;
+    mapc.valid = 1;
+    mapc.world = gs.world;
+    mapc.x0 = x0;
+    mapc.z0 = z0;
+    mapc.y = y;
+}
+
+// world data was updated - mark the affected columns
+void hud_blocks_update(MCPacket *pkt) {
+    int i;
+    switch (pkt->pid) {
+        case SP_BlockChange: {
+            SP_BlockChange_pkt *tpkt = &pkt->_SP_BlockChange;
+            mapc_mark(tpkt->pos.x, tpkt->pos.z);
+            break;
+        }
+        case SP_MultiBlockChange: {
+            SP_MultiBlockChange_pkt *tpkt = &pkt->_SP_MultiBlockChange;
+            for(i=0; i<tpkt->count; i++)
+                mapc_mark((tpkt->X<<4)+tpkt->blocks[i].x, (tpkt->Z<<4)+tpkt->blocks[i].z);
+            break;
+        }
+        case SP_Explosion: {
+            SP_Explosion_pkt *tpkt = &pkt->_SP_Explosion;
+            int32_t x = (int32_t)floor(tpkt->x), z = (int32_t)floor(tpkt->z);
+            for(i=0; i<tpkt->count; i++)
+                mapc_mark(x+tpkt->blocks[i].dx, z+tpkt->blocks[i].dz);
+            break;
+        }
+    }
+}
+
+// a chunk was loaded or unloaded - mark its columns
+void hud_chunk_update(int32_t X, int32_t Z) {
+    if (!mapc.valid) return;
+    if ((X<<4)+15 < mapc.x0 || (X<<4) >= mapc.x0+128 ||
+        (Z<<4)+15 < mapc.z0 || (Z<<4) >= mapc.z0+128) return;
+
+    int i,j;
+    for(i=0; i<16; i++)
+        for(j=0; j<16; j++)
+            mapc_mark((X<<4)+j, (Z<<4)+i);
+    hud_invalidate(HUDINV_BLOCKS);
+}
+
+int huddraw_map() {
+    if (!(hud_inv & HUDINVMASK_MAP)) return 0;
 
     bg_color = B0(COLOR_BLACK);
-    draw_clear();
 
     int32_t x = (int32_t)floor(gs.own.x);
     int32_t y = (int32_t)floor(gs.own.y);
     int32_t z = (int32_t)floor(gs.own.z);
-    extent_t ex = { { x-80, y-12, z-80 }, { x+80, y+3, z+80 } };
-    cuboid_t cb = export_cuboid_extent(ex);
+    mapc_update(x, y, z);
 
-    int r,c,i,j;
-    int32_t off = cb.boff + 16*cb.sa.x + 16;
-    for(r=0; r<128; r++) {
-        for(c=0; c<128; c++) {
-            int poff = off+r*cb.sa.x+c;
-            for(j=0; j<16; j++) {
-                if ( cb.data[j][poff].bid ) {
-                    int8_t color = BLOCK_COLORMAP[cb.data[j][poff].bid][cb.data[j][poff].meta];
-                    hud_image[r*128+c] = color*4 + shading[j];
-                }
-            }
-        }
-    }
-
-    for(i=0; i<256; i++) lh_free(cb.data[i]);
+    int i;
+    for(i=0; i<16384; i++)
+        hud_image[i] = (mapc.col[i] == MAPC_NONE) ? bg_color : mapc.col[i];
 
     hud_image[64*128+64] = 126;
 
@@ -852,6 +1086,15 @@ int huddraw_map() {
     return 1;
 }
 
+// Tunnel radar: for each pixel, the second derivative of the block occupancy
+// across x and z, summed over a 16-block window along the other axis and
+// over 5 layers around the player's y. With O being the occupancy summed over
+// the layers, both sums reduce to differences of window sums of O, which are
+// taken from prefix sums - so the cost per frame is proportional to pixels.
+
+#define TUN_B   8               // border needed around the 128x128 view
+#define TUN_S   (128+2*TUN_B)   // size of the occupancy grid
+
 int huddraw_tunnel() {
     if (!(hud_inv & HUDINVMASK_TUNNEL)) return 0;
 
@@ -862,25 +1105,50 @@ int huddraw_tunnel() {
     int32_t x = (int32_t)floor(gs.own.x);
     int32_t y = (int32_t)floor(gs.own.y);
     int32_t z = (int32_t)floor(gs.own.z);
-    extent_t ex = { { x-80, y-2, z-80 }, { x+80, y+2, z+80 } };
-    cuboid_t cb = export_cuboid_extent(ex);
 
-    int r,c,i,j;
-    int32_t off = cb.boff + 16*cb.sa.x + 16;
+    static int8_t  occ[TUN_S][TUN_S];      // [z][x] number of occupied layers
+    static int16_t pz[TUN_S+1][TUN_S];     // prefix sums of occ along z
+    static int16_t px[TUN_S][TUN_S+1];     // prefix sums of occ along x
+
+    int32_t xo = x-64-TUN_B, zo = z-64-TUN_B;
+    int r,c,j;
+    for(r=0; r<TUN_S; r++) {
+        int32_t bz = zo+r;
+        gschunk *gc = NULL;
+        for(c=0; c<TUN_S; c++) {
+            int32_t bx = xo+c;
+            if (c==0 || (bx&15)==0)
+                gc = page_chunk(gs.world, bx>>4, bz>>4);
+
+            int n=0;
+            if (gc) {
+                for(j=y-2; j<=y+2; j++)
+                    if (j>=0 && j<256)
+                        n += (gc->blocks[j*256+(bz&15)*16+(bx&15)].bid != 0);
+            }
+            occ[r][c] = n;
+        }
+    }
+
+    for(c=0; c<TUN_S; c++) pz[0][c] = 0;
+    for(r=0; r<TUN_S; r++) {
+        px[r][0] = 0;
+        for(c=0; c<TUN_S; c++) {
+            pz[r+1][c] = pz[r][c] + occ[r][c];
+            px[r][c+1] = px[r][c] + occ[r][c];
+        }
+    }
+
+    // window sums of 16 blocks, from -8 to +7 relative to the pixel
+#define VSUM(gr,gc) (pz[(gr)+8][gc] - pz[(gr)-8][gc])
+#define HSUM(gr,gc) (px[gr][(gc)+8] - px[gr][(gc)-8])
+
     for(r=0; r<128; r++) {
+        int gr = r+TUN_B;
         for(c=0; c<128; c++) {
-            int poff = off+r*cb.sa.x+c;
-            int s1=0,s2=0;
-            for(i=-8; i<8; i++) {
-                for(j=0; j<5; j++) {
-                    s1+= (cb.data[j][poff-1+i*cb.sa.x].bid != 0)
-                      -2*(cb.data[j][poff+0+i*cb.sa.x].bid != 0)
-                      +  (cb.data[j][poff+1+i*cb.sa.x].bid != 0);
-                    s2+= (cb.data[j][poff+i  -cb.sa.x].bid != 0)
-                      -2*(cb.data[j][poff+i          ].bid != 0)
-                      +  (cb.data[j][poff+i  +cb.sa.x].bid != 0);
-                }
-            }
+            int gc = c+TUN_B;
+            int s1 = VSUM(gr,gc-1) - 2*VSUM(gr,gc) + VSUM(gr,gc+1);
+            int s2 = HSUM(gr-1,gc) - 2*HSUM(gr,gc) + HSUM(gr+1,gc);
             int s = MAX(s1,s2);
             if (s>10) hud_image[r*128+c] = B3(COLOR_RED);
             if (s>30) hud_image[r*128+c] = B3(COLOR_ORANGE);
@@ -889,7 +1157,8 @@ int huddraw_tunnel() {
         }
     }
 
-    for(i=0; i<256; i++) lh_free(cb.data[i]);
+#undef VSUM
+#undef HSUM
 
     hud_image[64*128+64] = B3(COLOR_DIAMOND_BLUE);
 
@@ -1300,6 +1569,7 @@ void hud_prune() {
             return;
 
     hud_id = -1; // HUD item not found in the inventory - invalidate ID
+    hud_last_valid = 0;
 }
 
 /*
@@ -1381,45 +1651,110 @@ void hud_cmd(char **words, MCPacketQueue *sq, MCPacketQueue *cq) {
     if (reply[0]) chat_message(reply, cq, "green", rpos);
 }
 
-void hud_update(MCPacketQueue *cq) {
-    hud_prune();
-    if (hud_id < 0 || !hud_inv) return;
+////////////////////////////////////////////////////////////////////////////////
+// Delta updates
+
+// minimum interval between two HUD frames (us)
+#define HUD_MININTERVAL 50000
+
+// unchanged rows that still get merged into the same update band
+#define HUD_BANDGAP     8
+#define HUD_MAXBANDS    4
+
+// send a rectangular part of hud_image
+static void hud_send_rect(int c1, int r1, int c2, int r2, MCPacketQueue *cq) {
+    int w = c2-c1+1, h = r2-r1+1;
+
+    NEWPACKET(SP_Map, map);
+    tmap->mapid    = hud_id;
+    tmap->scale    = 0;
+    tmap->trackpos = 0;
+    tmap->nicons   = 0;
+    tmap->icons    = NULL;
+    tmap->ncols    = w;
+    tmap->nrows    = h;
+    tmap->X        = c1;
+    tmap->Z        = r1;
+    tmap->len      = w*h;
+    lh_alloc_num(tmap->data, w*h);
+
+    int r;
+    for(r=0; r<h; r++)
+        memmove(tmap->data+r*w, hud_image+(r1+r)*128+c1, w);
+
+    queue_packet(map, cq);
+}
 
+// diff hud_image against the last transmitted picture and send the changed
+// rows as a few bands, each clipped to the columns that actually changed
+static void hud_send_delta(MCPacketQueue *cq) {
+    if (!hud_last_valid) {
+        hud_send_rect(0, 0, 127, 127, cq);
+        memmove(hud_last, hud_image, sizeof(hud_image));
+        hud_last_valid = 1;
+        return;
+    }
+
+    int nb=0, bc1=0, bc2=0, br1=0, br2=0;
+    int r;
+    for(r=0; r<128; r++) {
+        uint8_t *a = hud_image+r*128, *b = hud_last+r*128;
+        if (!memcmp(a, b, 128)) continue;
+
+        int c1=0, c2=127;
+        while (a[c1]==b[c1]) c1++;
+        while (a[c2]==b[c2]) c2--;
+
+        if (nb && (r-br2 <= HUD_BANDGAP || nb==HUD_MAXBANDS)) {
+            // extend the current band
+            if (c1<bc1) bc1=c1;
+            if (c2>bc2) bc2=c2;
+            br2 = r;
+            continue;
+        }
+
+        if (nb) hud_send_rect(bc1, br1, bc2, br2, cq);
+        nb++;
+        bc1=c1; bc2=c2; br1=br2=r;
+    }
+    if (nb) hud_send_rect(bc1, br1, bc2, br2, cq);
+
+    memmove(hud_last, hud_image, sizeof(hud_image));
+}
+
+// render a HUD page into hud_image, returns nonzero if the page has changed
+int hud_draw(int mode) {
     bg_color = 34;
     draw_clear();
     bg_color = 0;
 
-    int updated = 0;
-
-    switch(hud_mode) {
-        case HUDMODE_TEST:      updated = huddraw_test();   break;
-        case HUDMODE_INFO:      updated = huddraw_info();   break;
-        case HUDMODE_TUNNEL:    updated = huddraw_tunnel(); break;
-        case HUDMODE_MAP:       updated = huddraw_map();    break;
-        case HUDMODE_BUILD:     updated = huddraw_build();  break;
-        case HUDMODE_HELP:      updated = huddraw_help();   break;
-        default:                break;
+    switch(mode) {
+        case HUDMODE_TEST:      return huddraw_test();
+        case HUDMODE_INFO:      return huddraw_info();
+        case HUDMODE_TUNNEL:    return huddraw_tunnel();
+        case HUDMODE_MAP:       return huddraw_map();
+        case HUDMODE_BUILD:     return huddraw_build();
+        case HUDMODE_HELP:      return huddraw_help();
     }
+    return 0;
+}
+
+// returns the time when a pending update can be drawn, 0 if there is none
+uint64_t hud_update(MCPacketQueue *cq) {
+    hud_prune();
+    if (hud_id < 0 || !hud_inv) return 0;
+
+    // keep the invalidation flags, the frame will be drawn on a later call
+    uint64_t ts = gettimestamp();
+    if (ts < hud_last_ts+HUD_MININTERVAL) return hud_last_ts+HUD_MININTERVAL;
 
-    if (updated) {
-        NEWPACKET(SP_Map, map);
-        tmap->mapid    = hud_id;
-        tmap->scale    = 0;
-        tmap->trackpos = 0;
-        tmap->nicons   = 0;
-        tmap->icons    = NULL;
-        tmap->ncols    = 128;
-        tmap->nrows    = 128;
-        tmap->X        = 0;
-        tmap->Z        = 0;
-        tmap->len      = sizeof(hud_image);
-        lh_alloc_num(tmap->data, sizeof(hud_image));
-        memmove(tmap->data, hud_image, sizeof(hud_image));
-
-        queue_packet(map, cq);
+    if (hud_draw(hud_mode)) {
+        hud_send_delta(cq);
+        hud_last_ts = ts;
     }
 
     hud_inv = HUDINV_NONE;
+    return 0;
 }
 
 void hud_invalidate(uint64_t flags) {
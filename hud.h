@@ -12,6 +12,13 @@
 
 #include "mcp_packet.h"
 
+#define HUDMODE_TEST            0
+#define HUDMODE_INFO            1
+#define HUDMODE_TUNNEL          2
+#define HUDMODE_MAP             3
+#define HUDMODE_BUILD           4
+#define HUDMODE_HELP            5
+
 #define HUDINV_NONE             0LL
 #define HUDINV_ANY              (HUDINV_NONE-1)
 #define HUDINV_POSITION         (1LL<<1)
@@ -25,5 +32,9 @@
 int  hud_bogus_map(slot_t *s);
 void hud_cmd(char **words, MCPacketQueue *sq, MCPacketQueue *cq);
 void hud_renew(MCPacketQueue *cq);
-void hud_update(MCPacketQueue *cq);
+int  hud_bind(char *reply, int id);
+int  hud_draw(int mode);
+uint64_t hud_update(MCPacketQueue *cq);
 void hud_invalidate(uint64_t flags);
+void hud_blocks_update(MCPacket *pkt);
+void hud_chunk_update(int32_t X, int32_t Z);
@@ -0,0 +1,191 @@
+/*
+ Authors:
+ Copyright 2012-2016 by Eduard Broese <ed.broese@gmx.de>
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version
+ 2 of the License, or (at your option) any later version.
+*/
+
+/*
+  mcp_archive : paging of the gamestate chunks from a local world
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+
+#include <lh_buffers.h>
+
+#include "mcp_archive.h"
+#include "mcp_gamestate.h"
+#include "anvil.h"
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Chunks missing in the gamestate are paged in from the region files of a
+// local world, keeping a few region files mapped. The paged chunks are
+// dropped again in LRU order once they exceed the memory budget. Chunk
+// pointers are only held until the end of a main loop pass, so archive_trim
+// may drop any of them, while paging in a chunk over the budget only drops
+// the chunks not used since the last trim - if there are none, paging is
+// refused until the next trim
+
+#define ARCHIVE_REGIONS 16
+
+typedef struct {
+    gsworld    *w;
+    int32_t     RX, RZ;
+    mca        *region;         // NULL if the region file is not available
+    uint32_t    used;
+} arcregion;
+
+typedef struct {
+    gsworld    *w;
+    int32_t     X, Z;
+    gschunk    *gc;
+    uint32_t    stamp;
+} arcchunk;
+
+static struct {
+    char        dir[PATH_MAX];
+    ssize_t     budget;         // max number of paged chunks
+    uint32_t    mark;           // last LRU stamp at the time of the last trim
+    arcregion   reg[ARCHIVE_REGIONS];
+    uint32_t    tick;
+    lh_arr_declare(arcchunk,ch);
+} archive;
+
+// region directory of the world's dimension within the archive
+static const char * archive_dim(gsworld *w) {
+    if (w == &gs.overworld) return "region";
+    if (w == &gs.nether)    return "DIM-1/region";
+    if (w == &gs.end)       return "DIM1/region";
+    return NULL;
+}
+
+static mca * archive_region(gsworld *w, int32_t RX, int32_t RZ) {
+    const char *dim = archive_dim(w);
+    if (!dim) return NULL;
+
+    int i, lru = 0;
+    for(i=0; i<ARCHIVE_REGIONS; i++) {
+        arcregion *ar = archive.reg+i;
+        if (ar->used && ar->w==w && ar->RX==RX && ar->RZ==RZ) {
+            ar->used = ++archive.tick;
+            return ar->region;
+        }
+        if (ar->used < archive.reg[lru].used) lru = i;
+    }
+
+    // replace the least recently used region
+    arcregion *ar = archive.reg+lru;
+    if (ar->region) anvil_free(ar->region);
+
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s/r.%d.%d.mca", archive.dir, dim, RX, RZ);
+    ar->w = w;
+    ar->RX = RX;
+    ar->RZ = RZ;
+    ar->region = anvil_load(path);
+    ar->used = ++archive.tick;
+    return ar->region;
+}
+
+// forget chunks that were freed or taken over by server data, and update
+// the stamps of the remaining ones
+static void archive_validate() {
+    int i, n = 0;
+    for(i=0; i<C(archive.ch); i++) {
+        arcchunk *ac = P(archive.ch)+i;
+        gschunk *gc = peek_chunk(ac->w, ac->X, ac->Z);
+        if (gc != ac->gc || !gc->paged) continue;
+        ac->stamp = gc->paged;
+        P(archive.ch)[n++] = *ac;
+    }
+    C(archive.ch) = n;
+}
+
+// make room for one more paged chunk, returns 0 if all paged chunks were
+// used since the last trim
+static int archive_reserve() {
+    if (C(archive.ch) < archive.budget) return 1;
+    archive_validate();
+    if (C(archive.ch) < archive.budget) return 1;
+
+    int i, lru = -1;
+    for(i=0; i<C(archive.ch); i++) {
+        arcchunk *ac = P(archive.ch)+i;
+        if (ac->stamp > archive.mark) continue;
+        if (lru<0 || ac->stamp < P(archive.ch)[lru].stamp) lru = i;
+    }
+    if (lru < 0) return 0;
+
+    arcchunk *ac = P(archive.ch)+lru;
+    drop_chunk(ac->w, ac->X, ac->Z);
+    lh_arr_delete(GAR(archive.ch), lru);
+    return 1;
+}
+
+static int archive_pager(gsworld *w, int32_t X, int32_t Z, gschunk *gc) {
+    mca *region = archive_region(w, X>>5, Z>>5);
+    if (!region || !region->data[(X&0x1f)+((Z&0x1f)<<5)]) return 0;
+    if (!gc) return 1;
+
+    if (!archive_reserve()) return 0;
+    if (anvil_import_gschunk(region, X, Z, gc)) return 0;
+
+    arcchunk *ac = lh_arr_new(GAR(archive.ch));
+    ac->w = w;
+    ac->X = X;
+    ac->Z = Z;
+    ac->gc = gc;
+    return 1;
+}
+
+// page in chunks from the world at worlddir, keeping at most
+// budget_mb megabytes of paged chunks
+void archive_open(const char *worlddir, int budget_mb) {
+    archive_close();
+    snprintf(archive.dir, sizeof(archive.dir), "%s", worlddir);
+    archive.budget = MAX(1, ((ssize_t)budget_mb<<20)/(ssize_t)sizeof(gschunk));
+    gs_set_pager(archive_pager);
+}
+
+void archive_close() {
+    gs_set_pager(NULL);
+
+    int i;
+    for(i=0; i<ARCHIVE_REGIONS; i++)
+        if (archive.reg[i].region)
+            anvil_free(archive.reg[i].region);
+    lh_clear_obj(archive.reg);
+    lh_arr_free(GAR(archive.ch));
+    archive.mark = 0;
+}
+
+static int cmp_stamp(const void *a, const void *b) {
+    uint32_t sa = ((const arcchunk *)a)->stamp, sb = ((const arcchunk *)b)->stamp;
+    return (sa>sb) - (sa<sb);
+}
+
+// drop the least recently used paged chunks over the budget - must be
+// called when no chunk pointers are held, e.g. from the main loop
+void archive_trim() {
+    archive_validate();
+
+    // chunks used after this point may be held by the callers
+    int i, n = C(archive.ch);
+    for(i=0; i<n; i++)
+        archive.mark = MAX(archive.mark, P(archive.ch)[i].stamp);
+    if (n <= archive.budget) return;
+
+    qsort(P(archive.ch), n, sizeof(arcchunk), cmp_stamp);
+    int drop = n-archive.budget;
+    for(i=0; i<drop; i++) {
+        arcchunk *ac = P(archive.ch)+i;
+        drop_chunk(ac->w, ac->X, ac->Z);
+    }
+    lh_arr_delete_range(GAR(archive.ch), 0, drop);
+}
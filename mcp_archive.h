@@ -0,0 +1,17 @@
+/*
+ Authors:
+ Copyright 2012-2016 by Eduard Broese <ed.broese@gmx.de>
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version
+ 2 of the License, or (at your option) any later version.
+*/
+
+
+#pragma once
+
+// page chunks missing in the gamestate in from the region files of a local world
+void archive_open(const char *worlddir, int budget_mb);
+void archive_close();
+void archive_trim();
@@ -28,11 +28,19 @@
 void bplan_free(bplan * bp) {
     if (!bp) return;
     lh_arr_free(BP);
+    lh_free(bp->hidx);
+    bp->hsize = bp->hcount = 0;
+    bgrid_free(bp->grid);
+    bp->grid = NULL;
+    bp->gridonly = 0;
 }
 
 void bplan_update(bplan * bp) {
     assert(bp);
 
+    // the extents are kept up to date by the grid transforms
+    if (bp->gridonly) return;
+
     if (BPC==0) {
         // no blocks in the buildplan
         bp->maxx=bp->maxy=bp->maxz = 0;
@@ -61,6 +69,7 @@ void bplan_update(bplan * bp) {
 }
 
 void bplan_dump(bplan *bp) {
+    if (bp) bplan_sync(bp);
     if (!bp || BPC==0) {
         printf("Buildplan is empty\n");
         return;
@@ -78,26 +87,229 @@ void bplan_dump(bplan *bp) {
     }
 }
 
+////////////////////////////////////////////////////////////////////////////////
+// Coordinate index
+
+static inline uint32_t bplan_hash(int32_t x, int32_t y, int32_t z) {
+    return ((uint32_t)x*73856093u) ^ ((uint32_t)y*19349663u) ^ ((uint32_t)z*83492791u);
+}
+
+void bplan_invalidate(bplan *bp) {
+    assert(bp);
+    bplan_sync(bp);
+    lh_free(bp->hidx);
+    bp->hsize = bp->hcount = 0;
+    bgrid_free(bp->grid);
+    bp->grid = NULL;
+}
+
+// rebuild the index from the block list, sized for at least n blocks
+static void bplan_reindex(bplan *bp, ssize_t n) {
+    lh_free(bp->hidx);
+    bp->hsize = 256;
+    while(bp->hsize < 2*n) bp->hsize <<= 1;
+    lh_alloc_num(bp->hidx, bp->hsize);
+
+    uint32_t mask = bp->hsize-1;
+    int i;
+    for(i=0; i<BPC; i++) {
+        blkr *b = BPP+i;
+        uint32_t h = bplan_hash(b->x, b->y, b->z)&mask;
+        while(bp->hidx[h]) h=(h+1)&mask;
+        bp->hidx[h] = i+1;
+    }
+    bp->hcount = BPC;
+}
+
+// grow the buildplan extents to include a new block
+static inline void bplan_extend_extents(bplan *bp, blkr *b) {
+    if (BPC==0) {
+        bp->maxx=bp->minx = b->x;
+        bp->maxy=bp->miny = b->y;
+        bp->maxz=bp->minz = b->z;
+    }
+    else {
+        bp->maxx = MAX(b->x, bp->maxx);
+        bp->minx = MIN(b->x, bp->minx);
+        bp->maxy = MAX(b->y, bp->maxy);
+        bp->miny = MIN(b->y, bp->miny);
+        bp->maxz = MAX(b->z, bp->maxz);
+        bp->minz = MIN(b->z, bp->minz);
+    }
+
+    bp->sx = bp->maxx-bp->minx+1;
+    bp->sy = bp->maxy-bp->miny+1;
+    bp->sz = bp->maxz-bp->minz+1;
+}
+
 // add a new block to the buildplan. If a block with this coordinates
 // is already in the buildplan, it will be replaced
 // returns the index of the newly added block
+// the extents are updated incrementally, so there is no need to call
+// bplan_update() as long as the plan is only modified with bplan_add
 int bplan_add(bplan *bp, blkr block) {
     assert(bp);
 
-    int i;
-    for(i=0; i<BPC; i++) {
-        blkr *ob = BPP+i;
+    // the grid becomes outdated with the new block
+    if (bp->grid) bplan_invalidate(bp);
+
+    // (re)build the index if we don't have one yet or if the
+    // block list was modified without going through bplan_add
+    if (!bp->hidx || bp->hcount != BPC)
+        bplan_reindex(bp, BPC+1);
+
+    uint32_t mask = bp->hsize-1;
+    uint32_t h = bplan_hash(block.x, block.y, block.z)&mask;
+    for(; bp->hidx[h]; h=(h+1)&mask) {
+        blkr *ob = BPP+bp->hidx[h]-1;
         if (ob->x==block.x && ob->y==block.y && ob->z==block.z) {
             ob->b = block.b;
-            return i;
+            return bp->hidx[h]-1;
         }
     }
 
+    bplan_extend_extents(bp, &block);
+
     blkr *nb = lh_arr_new(BP);
     *nb = block;
+
+    // keep the table at most half full
+    if (2*BPC > bp->hsize) {
+        bplan_reindex(bp, BPC);
+    }
+    else {
+        bp->hidx[h] = BPC;
+        bp->hcount++;
+    }
+
     return BPC-1;
 }
 
+////////////////////////////////////////////////////////////////////////////////
+// Voxel grid
+
+bgrid * bplan_grid(bplan *bp) {
+    assert(bp);
+    if (bp->grid) return bp->grid;
+    bplan_update(bp);
+
+    lh_create_obj(bgrid, g);
+    g->x   = bp->minx-BGRID_BORDER;
+    g->y   = bp->miny-BGRID_BORDER;
+    g->z   = bp->minz-BGRID_BORDER;
+    g->sx  = bp->sx+2*BGRID_BORDER;
+    g->sy  = bp->sy+2*BGRID_BORDER;
+    g->sz  = bp->sz+2*BGRID_BORDER;
+    g->sxz = g->sx*g->sz;
+    lh_alloc_num(g->v, (ssize_t)g->sxz*g->sy);
+
+    // duplicate blocks in the list collapse into one voxel
+    int i;
+    bp->gcount = 0;
+    for(i=0; i<BPC; i++) {
+        blkr *b = BPP+i;
+        bid_t *v = g->v+BGOFF(g, b->x, b->y, b->z);
+        bp->gcount += (v->bid == 0);
+        *v = b->b;
+    }
+
+    bp->grid = g;
+    return g;
+}
+
+// the grid was modified by a transform - the block list is outdated,
+// count the blocks and recalculate the extents from the grid
+static void bplan_grid_changed(bplan *bp) {
+    bgrid *g = bp->grid;
+    lh_free(bp->hidx);
+    bp->hsize = bp->hcount = 0;
+    bp->gridonly = 1;
+
+    int32_t x0=g->sx, y0=g->sy, z0=g->sz, x1=-1, y1=-1, z1=-1;
+    ssize_t count = 0;
+    bid_t *v = g->v;
+    int x,y,z;
+    for(y=0; y<g->sy; y++) {
+        for(z=0; z<g->sz; z++) {
+            for(x=0; x<g->sx; x++,v++) {
+                if (!v->bid) continue;
+                count++;
+                x0 = MIN(x0,x); x1 = MAX(x1,x);
+                y0 = MIN(y0,y); y1 = MAX(y1,y);
+                z0 = MIN(z0,z); z1 = MAX(z1,z);
+            }
+        }
+    }
+    bp->gcount = count;
+
+    if (!count) {
+        bp->maxx=bp->maxy=bp->maxz = 0;
+        bp->minx=bp->miny=bp->minz = 0;
+        bp->sx=bp->sy=bp->sz = 0;
+        return;
+    }
+
+    bp->minx = g->x+x0; bp->maxx = g->x+x1;
+    bp->miny = g->y+y0; bp->maxy = g->y+y1;
+    bp->minz = g->z+z0; bp->maxz = g->z+z1;
+    bp->sx = x1-x0+1;
+    bp->sy = y1-y0+1;
+    bp->sz = z1-z0+1;
+}
+
+void bplan_sync(bplan *bp) {
+    assert(bp);
+    if (bp->gridonly)
+        bplan_from_grid(bp, bp->grid);
+}
+
+ssize_t bplan_count(bplan *bp) {
+    assert(bp);
+    return bp->gridonly ? bp->gcount : BPC;
+}
+
+// the grid remains valid if it's the buildplan's own grid
+void bplan_from_grid(bplan *bp, bgrid *g) {
+    assert(bp);
+    assert(g);
+    lh_free(bp->hidx);
+    bp->hsize = bp->hcount = 0;
+    if (g != bp->grid) {
+        bgrid_free(bp->grid);
+        bp->grid = NULL;
+    }
+    bp->gridonly = 0;
+
+    // count the blocks first, so the list is allocated only once
+    ssize_t i, size = (ssize_t)g->sxz*g->sy, count=0;
+    for(i=0; i<size; i++)
+        count += (g->v[i].bid != 0);
+
+    lh_arr_declare_i(blkr, keep);
+    lh_arr_add(GAR(keep), count);
+
+    blkr  *k = P(keep);
+    bid_t *v = g->v;
+    int x,y,z;
+    for(y=0; y<g->sy; y++)
+        for(z=0; z<g->sz; z++)
+            for(x=0; x<g->sx; x++,v++)
+                if (v->bid)
+                    *k++ = (blkr) { g->x+x, g->y+y, g->z+z, *v };
+
+    lh_arr_free(BP);
+    BPC = C(keep);
+    BPP = P(keep);
+
+    bplan_update(bp);
+}
+
+void bgrid_free(bgrid *g) {
+    if (!g) return;
+    lh_free(g->v);
+    lh_free(g);
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 // Helpers
 
@@ -365,100 +577,65 @@ bplan * bplan_seal() {
 
 int bplan_hollow(bplan *bp, int flat, int opaque) {
     assert(bp);
-    bplan_update(bp);
 
-    int i;
-
-    // size of a single "slice" with additional 1-block border
-    int32_t size_xz = (bp->sx+2)*(bp->sz+2);
+    ssize_t count = bplan_count(bp);
 
-    // this array will hold the entire buildplan as a "voxel set"
-    // with values set to 0 for empty blocks, 1 for occupied and -1 for removed
-    // note - we leave an additional empty block for the border on each side
-    lh_create_num(int8_t,v,size_xz*(bp->sy+2));
+    // voxel set of the buildplan with an empty border on each side
+    bgrid *g = bplan_grid(bp);
+    ssize_t i, size = (ssize_t)g->sxz*g->sy;
 
-    // initialize the voxel set from the buildplan
-    for(i=0; i<BPC; i++) {
-        blkr *b = BPP+i;
-
-        // offset of this block in the array
-        int32_t off_x = b->x-bp->minx+1;
-        int32_t off_y = b->y-bp->miny+1;
-        int32_t off_z = b->z-bp->minz+1;
-        int32_t off   = off_x+off_z*(bp->sx+2)+off_y*size_xz;
-
-        if (b->b.bid) {
-            // block is present
-            v[off] = 1;
-            if (!opaque || (ITEMS[b->b.bid].flags&I_OPAQUE))
-                v[off] += 2; // Bit 1 - block is considered opaque
-        }
+    // mark which of the blocks are considered opaque
+    lh_create_num(uint8_t, o, size);
+    for(i=0; i<size; i++) {
+        bid_t b = g->v[i];
+        o[i] = b.bid && (!opaque || (ITEMS[b.bid].flags&I_OPAQUE));
     }
 
-    // mark the blocks completely surrounded by other blocks for removal
+    // remove the blocks completely surrounded by other blocks
     int x,y,z;
-    for(y=1; y<bp->sy+1; y++) {
-        int32_t off_y = size_xz*y;
-        for(z=1; z<bp->sz+1; z++) {
-            for(x=1; x<bp->sx+1; x++) {
-                int32_t off = off_y + x + z*(bp->sx+2);
-                if ( (v[off]&1) &&
-                     (v[off-1]&2) && (v[off+1]&2) &&
-                     (v[off-(bp->sx+2)]&2) && (v[off+(bp->sx+2)]&2) &&
-                     (((v[off-size_xz]&2) && (v[off+size_xz]&2))||flat) )
-                     v[off]&=0xfe; // disable "present" bit
+    for(y=1; y<g->sy-1; y++) {
+        for(z=1; z<g->sz-1; z++) {
+            int32_t off = 1+z*g->sx+y*g->sxz;
+            for(x=1; x<g->sx-1; x++,off++) {
+                if ( g->v[off].bid &&
+                     o[off-1] && o[off+1] &&
+                     o[off-g->sx] && o[off+g->sx] &&
+                     ((o[off-g->sxz] && o[off+g->sxz]) || flat) )
+                     g->v[off] = BLOCKTYPE(0,0);
             }
         }
     }
+    lh_free(o);
 
-    // new list for the build plan to hold only the blocks we keep after removal
-    lh_arr_declare_i(blkr, keep);
-    int removed=0;
+    // the list is only rebuilt when needed, so chained grid
+    // transforms can continue with the same grid
+    bplan_grid_changed(bp);
 
-    for(i=0; i<BPC; i++) {
-        blkr *b = BPP+i;
-
-        // offset of this block in the array
-        int32_t off_x = b->x-bp->minx+1;
-        int32_t off_y = b->y-bp->miny+1;
-        int32_t off_z = b->z-bp->minz+1;
-        int32_t off   = off_x+off_z*(bp->sx+2)+off_y*size_xz;
-
-        if (v[off]&1) {
-            blkr *k = lh_arr_new(GAR(keep));
-            *k = *b;
-        }
-        else
-            removed++;
-    }
-
-    // free our voxel set
-    lh_free(v);
-
-    // replace the buildplan with the reduced list
-    lh_arr_free(BP);
-    BPC = C(keep);
-    BPP = P(keep);
-
-    return removed;
+    return count-bp->gcount;
 }
 
 void bplan_extend(bplan *bp, int ox, int oz, int oy, int count) {
+    bplan_invalidate(bp);
+    if (count<=0) return;
+
     int i,j;
-    int bc=BPC;
+    ssize_t bc=BPC;
+    lh_arr_add(BP, bc*count);
+
+    // copy the original blocks in bulk and shift each copy
     for(i=1; i<=count; i++) {
+        blkr *bn = BPP+bc*i;
+        memmove(bn, BPP, bc*sizeof(blkr));
         for(j=0; j<bc; j++) {
-            blkr *bn = lh_arr_new(BP);
-            blkr *bo = BPP+j;
-            bn->x = bo->x+ox*i;
-            bn->y = bo->y+oy*i;
-            bn->z = bo->z+oz*i;
-            bn->b = bo->b;
+            bn[j].x += ox*i;
+            bn[j].y += oy*i;
+            bn[j].z += oz*i;
         }
     }
 }
 
 int bplan_replace(bplan *bp, bid_t mat1, bid_t mat2, int anymeta) {
+    bplan_invalidate(bp);
     // TODO: handle material replacement for the orientation-dependent metas
 
     // if mat2=Air, blocks will be removed.
@@ -494,6 +671,7 @@ int bplan_replace(bplan *bp, bid_t mat1, bid_t mat2, int anymeta) {
 
 // trim the buildplan by erasing block not fitting the criteria
 int bplan_trim(bplan *bp, int type, int32_t value) {
+    bplan_invalidate(bp);
     lh_arr_declare_i(blkr, keep);
 
     int i, count=0;
@@ -531,6 +709,7 @@ int bplan_trim(bplan *bp, int type, int32_t value) {
 
 // flip the buildplan across one of the axis
 void bplan_flip(bplan *bp, char mode) {
+    bplan_invalidate(bp);
     int i;
     for(i=0; i<BPC; i++) {
         blkr *b = BPP+i;
@@ -553,6 +732,7 @@ void bplan_flip(bplan *bp, char mode) {
 
 // flip the buildplan across one of the axis
 void bplan_tilt(bplan *bp, char mode) {
+    bplan_invalidate(bp);
     int i;
     int32_t x,y,z;
     for(i=0; i<BPC; i++) {
@@ -584,6 +764,7 @@ void bplan_tilt(bplan *bp, char mode) {
 
 // shift the buildplan so that the pivot is at the bottom leftmost near corner
 void bplan_normalize(bplan *bp) {
+    bplan_invalidate(bp);
     bplan_update(bp);
     int i;
     for(i=0; i<BPC; i++) {
@@ -598,52 +779,44 @@ void bplan_normalize(bplan *bp) {
 // shrink the buildplan to half size in each dimension
 void bplan_shrink(bplan *bp) {
     assert(bp);
-    bplan_update(bp);
 
     int i;
+    bgrid *g = bplan_grid(bp);
+    bplan_update(bp);
 
-    // size of a single "slice" with additional 1-block border
-    int32_t size_xz = bp->sx*bp->sz;
-    lh_create_num(bid_t,v,size_xz*bp->sy);
-
-    // initialize the voxel set from the buildplan
-    for(i=0; i<BPC; i++) {
-        blkr *b = BPP+i;
-
-        // offset of this block in the array
-        int32_t off_x = b->x-bp->minx;
-        int32_t off_y = b->y-bp->miny;
-        int32_t off_z = b->z-bp->minz;
-        int32_t off   = off_x+off_z*bp->sx+off_y*size_xz;
-        v[off] = b->b;
-    }
+    // the grid may be larger than the extents of the blocks
+    int32_t ox = bp->minx-g->x, oy = bp->miny-g->y, oz = bp->minz-g->z;
 
-    // new list for the build plan to hold the blocks from the shrinked model
-    lh_arr_declare_i(blkr, keep);
+    // new grid to hold the blocks from the shrinked model
+    lh_create_obj(bgrid, n);
+    n->x   = bp->minx-BGRID_BORDER;
+    n->y   = bp->miny-BGRID_BORDER;
+    n->z   = bp->minz-BGRID_BORDER;
+    n->sx  = MAX(0,(bp->sx-1)/2)+2*BGRID_BORDER;
+    n->sy  = MAX(0,(bp->sy-1)/2)+2*BGRID_BORDER;
+    n->sz  = MAX(0,(bp->sz-1)/2)+2*BGRID_BORDER;
+    n->sxz = n->sx*n->sz;
+    lh_alloc_num(n->v, (ssize_t)n->sxz*n->sy);
 
     int x,y,z;
-    for(y=bp->miny; y<bp->maxy-1; y+=2) {
-        for(x=bp->minx; x<bp->maxx-1; x+=2) {
-            for(z=bp->minz; z<bp->maxz-1; z+=2) {
-                int32_t off_x = x-bp->minx;
-                int32_t off_y = y-bp->miny;
-                int32_t off_z = z-bp->minz;
-                int32_t off   = off_x+off_z*bp->sx+off_y*size_xz;
-
+    for(y=0; y<bp->sy-2; y+=2) {
+        for(z=0; z<bp->sz-2; z+=2) {
+            for(x=0; x<bp->sx-2; x+=2) {
+                int32_t off = (x+ox)+(z+oz)*g->sx+(y+oy)*g->sxz;
                 int32_t offs[8] = {
                     off,
                     off+1,
-                    off+bp->sx,
-                    off+1+bp->sx,
-                    off+size_xz,
-                    off+1+size_xz,
-                    off+bp->sx+size_xz,
-                    off+1+bp->sx+size_xz
+                    off+g->sx,
+                    off+1+g->sx,
+                    off+g->sxz,
+                    off+1+g->sxz,
+                    off+g->sx+g->sxz,
+                    off+1+g->sx+g->sxz
                 };
 
                 int blk[256]; lh_clear_obj(blk);
                 for (i=0; i<8; i++) {
-                    int bid = v[offs[i]].bid;
+                    int bid = g->v[offs[i]].bid;
                     blk[bid]++;
                 }
                 bid_t mat = BLOCKTYPE(0,0);
@@ -651,52 +824,47 @@ void bplan_shrink(bplan *bp) {
                     if (blk[i]>4)
                         mat = BLOCKTYPE(i,0);
 
-                if (mat.bid) {
-                    blkr *k = lh_arr_new(GAR(keep));
-                    k->b = mat;
-                    k->x = bp->minx + (x-bp->minx)/2;
-                    k->y = bp->miny + (y-bp->miny)/2;
-                    k->z = bp->minz + (z-bp->minz)/2;
-                }
+                if (mat.bid)
+                    n->v[BGOFF(n, bp->minx+x/2, bp->miny+y/2, bp->minz+z/2)] = mat;
             }
         }
     }
 
-    // free our voxel set
-    lh_free(v);
-
-    // replace the buildplan with the reduced list
-    lh_arr_free(BP);
-    BPC = C(keep);
-    BPP = P(keep);
-
-    bplan_update(bp);
+    // replace the grid with the reduced one
+    bgrid_free(bp->grid);
+    bp->grid = n;
+    bplan_grid_changed(bp);
 }
 
 // scale up the buildplan
 void bplan_scale(bplan *bp, int scale) {
     assert(bp);
+    bplan_invalidate(bp);
 
     // new list for the build plan to hold the blocks from the scaled model
+    // allocated at once, since we know exactly how many blocks we get
     lh_arr_declare_i(blkr, keep);
+    if (scale > 0)
+        lh_arr_add(GAR(keep), BPC*scale*scale*scale);
+    blkr *k = P(keep);
 
     int i,x,y,z;
-    for(i=0; i<BPC; i++) {
+    for(i=0; i<BPC && scale>0; i++) {
         blkr *b = BPP+i;
         for(x=0; x<scale; x++) {
             for(y=0; y<scale; y++) {
                 for(z=0; z<scale; z++) {
-                    blkr *k = lh_arr_new(GAR(keep));
                     k->x = b->x*scale+x;
                     k->y = b->y*scale+y;
                     k->z = b->z*scale+z;
                     k->b = b->b;
+                    k++;
                 }
             }
         }
     }
 
-    // replace the buildplan with the reduced list
+    // replace the buildplan with the scaled list
     lh_arr_free(BP);
     BPC = C(keep);
     BPP = P(keep);
@@ -709,6 +877,7 @@ void bplan_scale(bplan *bp, int scale) {
 int bplan_save(bplan *bp, const char *name) {
     char fname[256];
     sprintf(fname, "bplan/%s.bplan", name);
+    bplan_sync(bp);
 
     // write all encoded blocks from the buildplan to the buffer
     lh_create_buf(buf, sizeof(blkr)*BPC);
@@ -765,26 +934,23 @@ int bplan_ssave(bplan *bp, const char *name) {
     char fname[256];
     sprintf(fname, "schematic/%s.schematic", name);
 
-    int i;
-
     // create Blocks and Data arrays from the buildplan
-    int32_t size_xz = bp->sx*bp->sz;
-    int32_t size = size_xz*bp->sy;
+    // the voxel grid has the same layout as the schematic arrays
+    bgrid *g = bplan_grid(bp);
+    int32_t size = bp->sx*bp->sy*bp->sz;
     lh_create_num(uint8_t,blocks,size);
     lh_create_num(uint8_t,data,size);
 
-    // initialize the voxel set from the buildplan
-    for(i=0; i<BPC; i++) {
-        blkr *b = BPP+i;
-
-        // offset of this block in the array
-        int32_t off_x = b->x-bp->minx;
-        int32_t off_y = b->y-bp->miny;
-        int32_t off_z = b->z-bp->minz;
-        int32_t off   = off_x+off_z*bp->sx+off_y*size_xz;
-
-        blocks[off] = b->b.bid;
-        data[off]   = b->b.meta;
+    int32_t i=0;
+    int x,y,z;
+    for(y=0; y<bp->sy; y++) {
+        for(z=0; z<bp->sz; z++) {
+            bid_t *v = g->v+BGOFF(g, bp->minx, bp->miny+y, bp->minz+z);
+            for(x=0; x<bp->sx; x++,i++) {
+                blocks[i] = v[x].bid;
+                data[i]   = v[x].meta;
+            }
+        }
     }
 
     // Construct the schematic NBT structure
@@ -798,25 +964,44 @@ int bplan_ssave(bplan *bp, const char *name) {
         nbt_new(NBT_BYTE_ARRAY, "Blocks", blocks, size),
         nbt_new(NBT_BYTE_ARRAY, "Data", data, size));
 
-    // Serialize the NBT data
-    ssize_t ssize = 2*size + 65536;
-    lh_create_num(uint8_t,sdata,ssize);
-    uint8_t *w = sdata;
-    nbt_write(&w, Schematic);
-    ssize_t ssize2 = w-sdata;
-    printf("Estimated %zd, serialized %zd\n",ssize,ssize2);
-
-    // Compress the data
+    // Serialize and compress the NBT data
     ssize_t clen;
-    uint8_t * cdata = lh_gzip_encode(sdata, ssize2, &clen);
+    uint8_t * cdata = nbt_compress(Schematic, 1, &clen);
+    nbt_free(Schematic);
     if (!cdata) return 0;
     printf("Compressed: %zd\n",clen);
 
     // Write to file
     ssize_t wbytes = lh_save(fname, cdata, clen);
+    lh_free(cdata);
     return wbytes>0;
 }
 
+typedef struct {
+    uint8_t *blocks, *metas;
+    int hg, wd, ln;
+} schematic_t;
+
+static const char *schematic_queries[] = {
+    "Blocks", "Data", "Height", "Width", "Length", NULL
+};
+
+static void schematic_el(int qi, const char *path, nbt_t *el, void *priv) {
+    schematic_t *sc = priv;
+    if (qi < 2) {
+        if (el->type != NBT_BYTE_ARRAY) return;
+        if (qi==0) sc->blocks = (uint8_t *)el->ba;
+        else       sc->metas  = (uint8_t *)el->ba;
+        return;
+    }
+    if (el->type != NBT_SHORT) return;
+    switch (qi) {
+        case 2: sc->hg = el->s; break;
+        case 3: sc->wd = el->s; break;
+        case 4: sc->ln = el->s; break;
+    }
+}
+
 bplan * bplan_sload(const char *name) {
     char fname[256];
     sprintf(fname, "schematic/%s.schematic", name);
@@ -834,27 +1019,24 @@ bplan * bplan_sload(const char *name) {
         return NULL;
     }
 
-    // parse the NBT structure
+    // extract the NBT elements relevant for us - the arrays are referenced
+    // in dbuf, the rest of the data is skipped without building a tree
+    schematic_t sc;
+    lh_clear_obj(sc);
     uint8_t *p = dbuf;
-    nbt_t *n = nbt_parse(&p);
-    if (!n || (p-dbuf)!=dlen) {
-        printf("Error parsing NBT data from %s", fname);
+    nbt_scan(&p, schematic_queries, schematic_el, &sc);
+    if ((p-dbuf)!=dlen || !sc.blocks || !sc.metas) {
+        printf("Error parsing NBT data from %s\n", fname);
+        lh_free(dbuf);
+        lh_free(buf);
         return NULL;
     }
 
-    // extract the NBT elements relevant for us
-    //nbt_dump(n);
-    nbt_t *Blocks = nbt_hget(n,"Blocks");
-    nbt_t *Metas  = nbt_hget(n,"Data");
-    nbt_t *Height = nbt_hget(n,"Height");
-    nbt_t *Length = nbt_hget(n,"Length");
-    nbt_t *Width  = nbt_hget(n,"Width");
-
-    uint8_t *blocks = (uint8_t *)Blocks->ba;
-    uint8_t *metas  = (uint8_t *)Metas->ba;
-    int hg = Height->s;
-    int wd = Width->s;
-    int ln = Length->s;
+    uint8_t *blocks = sc.blocks;
+    uint8_t *metas  = sc.metas;
+    int hg = sc.hg;
+    int wd = sc.wd;
+    int ln = sc.ln;
 
     // create a new buildplan
     lh_create_obj(bplan, bp);
@@ -877,7 +1059,6 @@ bplan * bplan_sload(const char *name) {
     }
 
     // cleanup
-    nbt_free(n);
     lh_free(dbuf);
     lh_free(buf);
 
@@ -886,6 +1067,7 @@ bplan * bplan_sload(const char *name) {
 
 int bplan_csvsave(bplan *bp, const char *name) {
     assert(bp);
+    bplan_sync(bp);
     bplan_update(bp);
 
     char fname[256];
@@ -23,12 +23,40 @@ typedef struct {
                         // positional meta is north-oriented
 } blkr;
 
+// dense voxel representation of a buildplan, used by the transforms that
+// need to look at block neighborhoods
+typedef struct {
+    int32_t x,y,z;             // buildplan coordinates of the voxel 0,0,0
+    int32_t sx,sy,sz;          // grid size in each dimension
+    int32_t sxz;               // size of a single horizontal slice
+    bid_t   *v;                // voxels, air means no block
+} bgrid;
+
+// offset of the voxel with the buildplan coordinates x,y,z in a grid
+#define BGOFF(g,bx,by,bz) (((bx)-(g)->x)+((bz)-(g)->z)*(g)->sx+((by)-(g)->y)*(g)->sxz)
+
+// empty border kept around the blocks in the buildplan's grid
+#define BGRID_BORDER 1
+
 typedef struct {
     lh_arr_declare(blkr,plan); // currently loaded/created buildplan
 
     int32_t maxx,maxy,maxz;    // max buildplan coordinate in each dimension
     int32_t minx,miny,minz;    // min buildplan coordinate in each dimension
     int32_t sx,sy,sz;          // buildplan size in each dimension
+
+    // coordinate -> block index lookup used by bplan_add, built lazily
+    // and dropped by any operation that moves or removes blocks
+    int32_t *hidx;             // open-addressing table, block index+1 or 0 if free
+    int32_t hsize;             // number of slots in the table (power of 2)
+    int32_t hcount;            // number of blocks recorded in the table
+
+    // voxel grid of the buildplan, built by the grid transforms and kept
+    // for the next one. If gridonly is set, the last modification was made
+    // in the grid and the block list is outdated until bplan_sync()
+    bgrid  *grid;
+    int     gridonly;
+    ssize_t gcount;            // number of blocks in the grid
 } bplan;
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -46,6 +74,27 @@ void bplan_dump(bplan *bp);
 // add a block to the buildplan
 int bplan_add(bplan *bp, blkr block);
 
+// drop the coordinate index and the grid before the block list is
+// modified directly - the list is brought up to date first
+void bplan_invalidate(bplan *bp);
+
+// bring the block list up to date if it was modified in the grid -
+// must be called before accessing the block list directly
+void bplan_sync(bplan *bp);
+
+// number of blocks in the buildplan, in whichever form is current
+ssize_t bplan_count(bplan *bp);
+
+// voxel grid of the buildplan with BGRID_BORDER empty voxels around
+// the blocks, built if necessary - owned by the buildplan
+bgrid * bplan_grid(bplan *bp);
+
+// replace the contents of the buildplan with the blocks from the grid
+void bplan_from_grid(bplan *bp, bgrid *g);
+
+// free a voxel grid
+void bgrid_free(bgrid *g);
+
 ////////////////////////////////////////////////////////////////////////////////
 // Helpers
 
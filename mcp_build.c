@@ -13,6 +13,8 @@
 #include <string.h>
 #include <strings.h>
 #include <math.h>
+#include <unistd.h>
+#include <pthread.h>
 
 #include <lh_buffers.h>
 #include <lh_files.h>
@@ -28,6 +30,9 @@
 #include "mcp_arg.h"
 
 
+// number of bytes still queued for the client, from mcproxy.c
+ssize_t client_backlog();
+
 #define EYEHEIGHT (52.0/32.0)
 #define YAWMARGIN 0.5
 
@@ -151,11 +156,39 @@ typedef struct {
     double dist;                // distance to the block center
 
     uint64_t last;              // last timestamp when we attempted to place this block
+
+    int16_t mi;                 // index of the block's base material in build.ms
+    int8_t  done;               // block is counted as placed in the material stats
+
+    int32_t order;              // position in the placement schedule, -1 if not scheduled
+
+    bid_t   pvb;                // preview block the client was last sent
+    int8_t  pvshown;            // nonzero if the client is showing pvb at this position
 } blk;
 
+typedef struct pvchunk pvchunk;
+
+typedef struct sched_job sched_job;
+
+// a stop on the planned walking route
+typedef struct {
+    int32_t x,z;                // center of the section to stand in
+    int32_t last;               // last schedule position placed from this stop
+} sched_stop;
+
 // maximum number of blocks in the buildable list
 #define MAXBUILDABLE 1024
 
+// maximum number of placements awaiting confirmation from the server
+#define MAXINFLIGHT 64
+
+// a placement sent to the server but not confirmed yet
+typedef struct {
+    int32_t     x,y,z;          // coordinates of the placed block
+    int         ti;             // index of the block in the buildtask
+    uint64_t    ts;             // timestamp when the placement was sent
+} inflight_t;
+
 struct {
     int64_t lastbuild;         // timestamp of last block placement
 
@@ -179,8 +212,56 @@ struct {
 
     int32_t     xmin,xmax,ymin,ymax,zmin,zmax;
 
+    // placement pipeline
+    inflight_t infl[MAXINFLIGHT]; // placements awaiting confirmation
+    int ninfl;
+    int64_t ivl;               // current interval between placements (us)
+    double lat, latdev;        // smoothed confirmation latency and its deviation (us)
+    double rej;                // smoothed rejection rate, 0..1
+    int nacked, nrejected, nexpired; // placement outcome counters
+    uint64_t rate_ts;          // start of the current rate measurement period
+    int rate_n;                // blocks confirmed in this period
+    double bps;                // effective placement rate, blocks/s
+
     int64_t preview_last_ts;
     MCPacketQueue preview_queue;
+
+    // preview index: buildtask blocks grouped by chunk
+    int pvgen;                 // buildtask generation the index was built for
+    lh_arr_declare(pvchunk,pvc);
+    int32_t *pvbi;             // buildtask block indices, grouped by chunk
+    int32_t *pvidx;            // chunk coordinates -> pvc index+1, open-addressing
+    int32_t pvsize;            // number of slots in pvidx (power of 2)
+
+    // preview transmission
+    int pvq_blocks;            // number of blocks in the queued preview packets
+    int pv_sent;               // blocks sent to the client in total
+    uint64_t pvrate_ts;        // start of the current rate measurement period
+    int pvrate_n;              // blocks sent in this period
+    double pvbps;              // preview throughput, blocks/s
+    ssize_t pvbacklog;         // last measured client backlog, -1 if unknown
+
+    // material statistics of the buildtask, kept up to date with the
+    // block updates from the server so the HUD can query them cheaply
+    lh_arr_declare(build_info_material,ms);
+    int ms_placed;             // number of buildtask blocks currently in place
+    int ms_valid;              // zero if the placed counts must be recomputed
+    int32_t *tidx;             // coordinate -> buildtask index+1, open-addressing
+    int32_t tsize;             // number of slots in tidx (power of 2)
+
+    // material totals of the buildplan
+    lh_arr_declare(build_info_material,ps);
+    int ps_valid;              // zero if the buildplan was modified
+
+    // placement schedule computed by the planner thread
+    int gen;                   // buildtask generation, incremented on every change
+    sched_job *sj;             // planner job in progress, NULL if none
+    int sched;                 // nonzero if blk.order is valid for the current buildtask
+    int sched_planned;         // number of blocks in the schedule
+    int sched_unsupported;     // blocks that could not be scheduled
+    double sched_route;        // length of the walking route, in blocks
+    double sched_bpm;          // planned placement rate, blocks per minute
+    lh_arr_declare(sched_stop,stops); // walking route
 } build;
 
 #define BTASK GAR(build.task)
@@ -205,6 +286,8 @@ struct {
                            // is canceled, otherwise phantom blocks will stay there until
                            // chunks are removed. This option overrides this behavior and
                            // retains the phantom blocks.
+    int window;            // maximum number of placements awaiting server confirmation
+    int adaptive;          // if nonzero - slow down placement if the server rejects blocks
 } buildopts = { 0 };
 
 typedef struct {
@@ -228,6 +311,8 @@ bopt_t OPTIONS[] = {
     { "anyface", "place on any faces even if they look away from player",   &buildopts.anyface, 0},
     { "bjump", "build while jumping/falling/swimming",                  &buildopts.bjump, 0},
     { "preview_retain", "Retain preview when buildtask is canceled",    &buildopts.preview_retain, 0},
+    { "window", "max number of placements awaiting server confirmation", &buildopts.window, 8},
+    { "adaptive", "adapt placement interval to server rejections",      &buildopts.adaptive, 1},
     { NULL, NULL, NULL, 0 }, //list terminator
 };
 
@@ -289,6 +374,219 @@ int prefetch_material(MCPacketQueue *sq, MCPacketQueue *cq, bid_t mat) {
     return -2; //material being fetched
 }
 
+////////////////////////////////////////////////////////////////////////////////
+// Material statistics
+
+// buildtasks larger than this are recomputed on multiple threads
+#define MS_PARALLEL_MIN 65536
+#define MS_MAXTHREADS   8
+
+static inline uint32_t task_hash(int32_t x, int32_t y, int32_t z) {
+    return ((uint32_t)x*73856093u) ^ ((uint32_t)y*19349663u) ^ ((uint32_t)z*83492791u);
+}
+
+// check if the world block bl matches the wanted block, ignoring state bits
+static inline int bid_in_place(bid_t want, bid_t bl) {
+    int smask = (ITEMS[want.bid].flags&I_STATE_MASK)^15;
+    return (bl.bid == want.bid && (bl.meta&smask)==(want.meta&smask));
+}
+
+static inline int block_in_place(blk *b, bid_t bl) {
+    return bid_in_place(b->b, bl);
+}
+
+static void build_sched_abort();
+static void build_pipe_reset();
+static void build_preview_chunk(int32_t X, int32_t Z);
+
+// find the buildtask block at the given coordinates, NULL if none
+static blk * find_task_block(int32_t x, int32_t y, int32_t z) {
+    if (!build.tidx) return NULL;
+    uint32_t mask = build.tsize-1;
+    uint32_t h = task_hash(x,y,z)&mask;
+    for(; build.tidx[h]; h=(h+1)&mask) {
+        blk *b = P(build.task)+build.tidx[h]-1;
+        if (b->x==x && b->y==y && b->z==z)
+            return b;
+    }
+    return NULL;
+}
+
+// rebuild the material list and the coordinate index of the buildtask,
+// must be called whenever blocks are added to or removed from the buildtask
+static void build_stats_reset() {
+    // any schedule or in-flight placement refers to the old buildtask
+    build_sched_abort();
+    build_pipe_reset();
+    build.gen++;
+    build.sched = 0;
+    lh_arr_free(GAR(build.stops));
+
+    lh_arr_free(GAR(build.ms));
+    lh_free(build.tidx);
+    build.tsize = 0;
+    build.ms_placed = 0;
+    build.ms_valid = 0;
+    if (!C(build.task)) return;
+
+    // material index for each distinct base material
+    lh_create_num(int16_t, lut, 65536);
+    int i;
+    for(i=0; i<C(build.task); i++) {
+        blk *b = P(build.task)+i;
+        bid_t bmat = get_base_material(b->b);
+        if (!lut[bmat.raw]) {
+            build_info_material *m = lh_arr_new_c(GAR1(build.ms));
+            m->material = bmat;
+            lut[bmat.raw] = C(build.ms);
+        }
+        b->mi = lut[bmat.raw]-1;
+        P(build.ms)[b->mi].total++;
+    }
+    lh_free(lut);
+
+    build.tsize = 256;
+    while(build.tsize < 2*C(build.task)) build.tsize <<= 1;
+    lh_alloc_num(build.tidx, build.tsize);
+
+    uint32_t mask = build.tsize-1;
+    for(i=0; i<C(build.task); i++) {
+        blk *b = P(build.task)+i;
+        uint32_t h = task_hash(b->x,b->y,b->z)&mask;
+        while(build.tidx[h]) h=(h+1)&mask;
+        build.tidx[h] = i+1;
+    }
+}
+
+// chunks covering the buildtask, resolved on the main thread
+// so the workers don't access the gamestate
+typedef struct {
+    gschunk   **ch;
+    int32_t     X, Z;           // chunk coordinates of ch[0]
+    int32_t     nx, nz;
+} ms_chunks;
+
+typedef struct {
+    int         from, to;       // range of buildtask blocks to check
+    int        *placed;         // placed counter for each material
+    ms_chunks  *mc;
+} ms_job;
+
+static void * build_stats_worker(void *arg) {
+    ms_job *job = arg;
+    ms_chunks *mc = job->mc;
+    int i;
+    for(i=job->from; i<job->to; i++) {
+        blk *b = P(build.task)+i;
+        gschunk *gc = mc->ch[((b->x>>4)-mc->X)+((b->z>>4)-mc->Z)*mc->nx];
+        bid_t bl = gc ? gc->blocks[b->y*256+(b->z&15)*16+(b->x&15)] : BLOCKTYPE(0,0);
+        b->done = block_in_place(b, bl);
+        if (b->done) job->placed[b->mi]++;
+    }
+    return NULL;
+}
+
+static void build_stats_chunks(ms_chunks *mc) {
+    int32_t X1,Z1;
+    int i;
+    mc->X = X1 = P(build.task)[0].x>>4;
+    mc->Z = Z1 = P(build.task)[0].z>>4;
+    for(i=1; i<C(build.task); i++) {
+        blk *b = P(build.task)+i;
+        mc->X = MIN(mc->X, b->x>>4);
+        mc->Z = MIN(mc->Z, b->z>>4);
+        X1 = MAX(X1, b->x>>4);
+        Z1 = MAX(Z1, b->z>>4);
+    }
+    mc->nx = X1-mc->X+1;
+    mc->nz = Z1-mc->Z+1;
+
+    lh_alloc_num(mc->ch, (ssize_t)mc->nx*mc->nz);
+    int X,Z;
+    for(Z=0; Z<mc->nz; Z++)
+        for(X=0; X<mc->nx; X++)
+            mc->ch[X+Z*mc->nx] = page_chunk(gs.world, mc->X+X, mc->Z+Z);
+}
+
+// recompute the placed counts from the world data - large buildtasks are
+// split between several threads, the world is not modified meanwhile
+static void build_stats_recompute() {
+    if (!C(build.task)) {
+        build.ms_placed = 0;
+        build.ms_valid = 1;
+        return;
+    }
+
+    ms_chunks mc;
+    build_stats_chunks(&mc);
+
+    int nthreads = 1;
+    if (C(build.task) >= MS_PARALLEL_MIN) {
+        nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+        nthreads = MAX(1, MIN(nthreads, MS_MAXTHREADS));
+    }
+
+    ms_job jobs[MS_MAXTHREADS];
+    pthread_t threads[MS_MAXTHREADS];
+    int started[MS_MAXTHREADS];
+    int i,j, chunk = (C(build.task)+nthreads-1)/nthreads;
+    for(i=0; i<nthreads; i++) {
+        jobs[i].from = MIN(i*chunk, C(build.task));
+        jobs[i].to   = MIN((i+1)*chunk, C(build.task));
+        lh_alloc_num(jobs[i].placed, C(build.ms)+1);
+        jobs[i].mc = &mc;
+    }
+
+    for(i=1; i<nthreads; i++)
+        started[i] = !pthread_create(&threads[i], NULL, build_stats_worker, &jobs[i]);
+    build_stats_worker(&jobs[0]);
+
+    build.ms_placed = 0;
+    for(j=0; j<C(build.ms); j++)
+        P(build.ms)[j].placed = 0;
+
+    for(i=0; i<nthreads; i++) {
+        if (i>0) {
+            if (started[i])
+                pthread_join(threads[i], NULL);
+            else
+                build_stats_worker(&jobs[i]); // failed to spawn, do it here
+        }
+        for(j=0; j<C(build.ms); j++) {
+            P(build.ms)[j].placed += jobs[i].placed[j];
+            build.ms_placed += jobs[i].placed[j];
+        }
+        lh_free(jobs[i].placed);
+    }
+    lh_free(mc.ch);
+
+    build.ms_valid = 1;
+}
+
+// a block in the world has changed - update the stats if it's in the buildtask
+static void build_stats_block(int32_t x, int32_t y, int32_t z, bid_t bl) {
+    if (!build.ms_valid) return; // will be recomputed anyway
+
+    blk *b = find_task_block(x,y,z);
+    if (!b) return;
+
+    int done = block_in_place(b, bl);
+    if (done == b->done) return;
+
+    b->done = done;
+    P(build.ms)[b->mi].placed += done ? 1 : -1;
+    build.ms_placed += done ? 1 : -1;
+}
+
+// a chunk was loaded or unloaded - invalidate stats if it overlaps the buildtask
+void build_chunk_update(int32_t X, int32_t Z) {
+    if (!C(build.task)) return;
+    if (X < build.xmin>>4 || X > build.xmax>>4 ||
+        Z < build.zmin>>4 || Z > build.zmax>>4) return;
+    build.ms_valid = 0;
+    build_preview_chunk(X,Z);
+}
+
 static int build_info_compar(const void *a, const void *b) {
     const build_info_material *ma = a;
     const build_info_material *mb = b;
@@ -304,51 +602,65 @@ static int build_info_compar(const void *a, const void *b) {
 build_info * get_build_info(int plan) {
     lh_create_obj(build_info, bi)
 
-    if (!plan) build_update_placed();
+    // material stats for the buildplan or the buildtask
+    build_info_material *stats;
+    ssize_t nstats;
 
-    int total[65536], placed[65536], available[65536];
-    lh_clear_obj(total);
-    lh_clear_obj(placed);
-    lh_clear_obj(available);
-
-    // process build task or plan to calculate amounts of each material
     int i,j;
     if (plan) {
-        for (i=0; build.bp && i<C(build.bp->plan); i++) {
-            bid_t bmat = get_base_material(P(build.bp->plan)[i].b);
-            total[bmat.raw]++;
-            bi->total ++;
+        if (!build.ps_valid) {
+            lh_arr_free(GAR(build.ps));
+            lh_create_num(int16_t, lut, 65536);
+            if (build.bp) bplan_sync(build.bp);
+            for (i=0; build.bp && i<C(build.bp->plan); i++) {
+                bid_t bmat = get_base_material(P(build.bp->plan)[i].b);
+                if (!lut[bmat.raw]) {
+                    build_info_material *m = lh_arr_new_c(GAR1(build.ps));
+                    m->material = bmat;
+                    lut[bmat.raw] = C(build.ps);
+                }
+                P(build.ps)[lut[bmat.raw]-1].total++;
+            }
+            lh_free(lut);
+            build.ps_valid = 1;
         }
+        stats = P(build.ps);
+        nstats = C(build.ps);
+        bi->total = build.bp ? C(build.bp->plan) : 0;
     }
     else {
-        for (i=0; i<C(build.task); i++) {
-            bid_t bmat = get_base_material(P(build.task)[i].b);
-            total[bmat.raw]++;
-            bi->total++;
-            if (P(build.task)[i].placed) {
-                placed[bmat.raw]++;
-                bi->placed ++;
-            }
-        }
+        if (!build.ms_valid && C(build.task))
+            build_stats_recompute();
+        stats = P(build.ms);
+        nstats = C(build.ms);
+        bi->total = C(build.task);
+        bi->placed = build.ms_placed;
     }
 
     // available materials in the inventory
+    int16_t slotmat[45];
     for (i=9; i<45; i++) {
+        slotmat[i] = -1;
         if (gs.inv.slots[i].item<0 || gs.inv.slots[i].item>=0x100) continue;
         bid_t bmat = BLOCKTYPE(gs.inv.slots[i].item, gs.inv.slots[i].damage);
-        available[bmat.raw] += gs.inv.slots[i].count;
-        if (total[bmat.raw] > 0)
-            bi->available += gs.inv.slots[i].count;
+        for(j=0; j<nstats; j++) {
+            if (stats[j].material.raw == bmat.raw) {
+                slotmat[i] = j;
+                bi->available += gs.inv.slots[i].count;
+                break;
+            }
+        }
     }
 
     // store all stats where more blocks need to be placed into build_info struct
-    for(i=0; i<65536; i++) {
-        if (total[i] - placed[i] > 0) {
+    for(j=0; j<nstats; j++) {
+        if (stats[j].total - stats[j].placed > 0) {
             build_info_material * m = lh_arr_new_c(GAR1(bi->mat));
-            m->material.raw = i;
-            m->total = total[i];
-            m->placed = placed[i];
-            m->available = available[i];
+            *m = stats[j];
+            m->available = 0;
+            for (i=9; i<45; i++)
+                if (slotmat[i] == j)
+                    m->available += gs.inv.slots[i].count;
         }
     }
 
@@ -389,6 +701,514 @@ void calculate_material(int plan) {
     lh_free(bi);
 }
 
+////////////////////////////////////////////////////////////////////////////////
+// Build scheduler
+
+// The planner computes a placement order for the whole buildtask that
+// respects block support and keeps the player's walking distance short.
+// It runs on a worker thread against a snapshot of the world around the
+// buildtask, the result is adopted by build_progress once it's ready.
+
+#define SCHED_SECTION   6       // size of the xz sections the player stands in
+#define SCHED_2OPT_WIN  64      // route positions considered for each 2-opt move
+#define SCHED_2OPT_MAX  8       // maximum number of 2-opt passes
+#define SCHED_ROUNDS    8       // maximum number of passes over the route
+#define SCHED_WALKSPEED 4.317   // player walking speed, blocks/s
+#define SCHED_POLL      50000   // how often to check for a finished job (us)
+
+// buildtask block as seen by the planner
+typedef struct {
+    int32_t x,y,z;
+    bid_t   b;
+    int32_t sec;                // section index
+} sched_blk;
+
+struct sched_job {
+    pthread_t   thread;
+    volatile int done;          // set by the worker when the results are ready
+    volatile int abort;         // set by the main thread to stop the worker early
+    int         gen;            // buildtask generation this job was started for
+
+    // input
+    int         n;              // number of buildtask blocks
+    sched_blk  *blk;
+    cuboid_t    c;              // world snapshot: buildtask extent plus 1-block border
+    int32_t     xmin,ymin,zmin; // origin of the snapshot
+    int32_t     sx,sy,sz;       // size of the snapshot
+    double      px,pz;          // player position
+    double      tplace;         // expected time per block placement, s
+
+    // results
+    int32_t    *order;          // schedule position for each block, -1 if not scheduled
+    int         nplanned;
+    int         nplaced;        // blocks already in place
+    int         nunsupported;   // blocks without any support or obstructed
+    double      route;          // walking distance, blocks
+    double      bpm;            // planned blocks per minute
+    lh_arr_declare(sched_stop,stops);
+};
+
+static inline int sched_off(sched_job *j, int32_t x, int32_t y, int32_t z) {
+    x-=j->xmin; y-=j->ymin; z-=j->zmin;
+    if (x<0 || y<0 || z<0 || x>=j->sx || y>=j->sy || z>=j->sz) return -1;
+    return x+(z+y*j->sz)*j->sx;
+}
+
+static inline bid_t sched_world(sched_job *j, int32_t x, int32_t y, int32_t z) {
+    x-=j->xmin; y-=j->ymin; z-=j->zmin;
+    return j->c.data[y][j->c.boff+z*j->c.sa.x+x];
+}
+
+static int sched_key_compar(const void *a, const void *b) {
+    uint64_t ka = *(const uint64_t *)a;
+    uint64_t kb = *(const uint64_t *)b;
+    return (ka>kb) - (ka<kb);
+}
+
+// order the sections by a greedy nearest-neighbor walk from the player,
+// then improve it with windowed 2-opt moves (open path, start is fixed)
+static void sched_route(sched_job *j, double *sx, double *sz, int ns, int32_t *tour) {
+    int i,k;
+
+    lh_create_num(int8_t, used, ns);
+    double cx=j->px, cz=j->pz;
+    for(i=0; i<ns && !j->abort; i++) {
+        int best=-1;
+        double bd=0;
+        for(k=0; k<ns; k++) {
+            if (used[k]) continue;
+            double d = SQ(sx[k]-cx)+SQ(sz[k]-cz);
+            if (best<0 || d<bd) { best=k; bd=d; }
+        }
+        tour[i] = best;
+        used[best] = 1;
+        cx = sx[best]; cz = sz[best];
+    }
+    lh_free(used);
+
+#define TX(p) ((p)<0 ? j->px : sx[tour[p]])
+#define TZ(p) ((p)<0 ? j->pz : sz[tour[p]])
+#define TD(p,q) sqrt(SQ(TX(p)-TX(q))+SQ(TZ(p)-TZ(q)))
+
+    int pass, improved=1;
+    for(pass=0; pass<SCHED_2OPT_MAX && improved && !j->abort; pass++) {
+        improved = 0;
+        // reverse tour[i+1..k], position -1 is the player
+        for(i=-1; i<ns-2; i++) {
+            for(k=i+2; k<ns && k<=i+SCHED_2OPT_WIN; k++) {
+                double delta = TD(i,k) - TD(i,i+1);
+                if (k<ns-1) delta += TD(i+1,k+1) - TD(k,k+1);
+                if (delta > -1e-9) continue;
+
+                int a=i+1, b=k;
+                while (a<b) {
+                    int32_t t=tour[a]; tour[a]=tour[b]; tour[b]=t;
+                    a++; b--;
+                }
+                improved = 1;
+            }
+        }
+    }
+
+#undef TX
+#undef TZ
+#undef TD
+}
+
+static void * build_sched_worker(void *arg) {
+    sched_job *j = arg;
+    int i,k,n=j->n;
+
+    // voxel grids over the snapshot: solid blocks and buildtask indices
+    int nv = j->sx*j->sy*j->sz;
+    lh_create_num(uint8_t, occ, nv);
+    lh_create_num(int32_t, gidx, nv);
+    for(i=0; i<n; i++)
+        gidx[sched_off(j, j->blk[i].x, j->blk[i].y, j->blk[i].z)] = i+1;
+
+    int32_t x,y,z;
+    for(y=j->ymin; y<j->ymin+j->sy; y++)
+        for(z=j->zmin; z<j->zmin+j->sz; z++)
+            for(x=j->xmin; x<j->xmin+j->sx; x++)
+                occ[sched_off(j,x,y,z)] = !ISEMPTY(sched_world(j,x,y,z).bid);
+
+    // state: 0-pending 1-queued or scheduled 2-excluded
+    lh_create_num(int8_t, state, n);
+    for(i=0; i<n; i++) {
+        j->order[i] = -1;
+        sched_blk *b = j->blk+i;
+        bid_t bl = sched_world(j, b->x, b->y, b->z);
+        if (bid_in_place(b->b, bl)) {
+            state[i] = 2;
+            j->nplaced++;
+        }
+        else if (!ISEMPTY(bl.bid)) {
+            state[i] = 2;
+            j->nunsupported++;
+        }
+    }
+
+    // split the buildtask into sections, sorted by y inside each one
+    int nsx = (j->sx+SCHED_SECTION-1)/SCHED_SECTION;
+    int nsz = (j->sz+SCHED_SECTION-1)/SCHED_SECTION;
+    lh_create_num(int32_t, secmap, nsx*nsz);
+    lh_create_num(uint64_t, keys, n);
+    int ns=0, nk=0;
+    for(i=0; i<n; i++) {
+        if (state[i]) continue;
+        sched_blk *b = j->blk+i;
+        int s = (b->x-j->xmin)/SCHED_SECTION + (b->z-j->zmin)/SCHED_SECTION*nsx;
+        if (!secmap[s]) secmap[s] = ++ns;
+        b->sec = secmap[s]-1;
+        keys[nk++] = ((uint64_t)b->sec<<40) | ((uint64_t)(b->y-j->ymin)<<32) | (uint32_t)i;
+    }
+    qsort(keys, nk, sizeof(*keys), sched_key_compar);
+
+    lh_create_num(int32_t, secstart, ns+1);
+    lh_create_num(double, secx, ns+1);
+    lh_create_num(double, secz, ns+1);
+    for(i=0; i<nsx*nsz; i++) {
+        if (!secmap[i]) continue;
+        secx[secmap[i]-1] = j->xmin + (i%nsx)*SCHED_SECTION + SCHED_SECTION/2.0;
+        secz[secmap[i]-1] = j->zmin + (i/nsx)*SCHED_SECTION + SCHED_SECTION/2.0;
+    }
+    for(i=0; i<nk; i++)
+        secstart[(keys[i]>>40)+1]++;
+    for(i=0; i<ns; i++)
+        secstart[i+1] += secstart[i];
+    lh_free(secmap);
+
+    lh_create_num(int32_t, tour, ns);
+    sched_route(j, secx, secz, ns, tour);
+
+    // walk the route, at each stop place everything that has support -
+    // from the world or from blocks scheduled before; blocks supported only
+    // by later sections are picked up on the next pass over the route
+    lh_create_num(int32_t, queue, n);
+    double cx=j->px, cz=j->pz;
+    int round, progress=1, next=0;
+    for(round=0; round<SCHED_ROUNDS && progress && !j->abort; round++) {
+        progress = 0;
+        for(k=0; k<ns && !j->abort; k++) {
+            int s = tour[k];
+            int qh=0, qt=0;
+            for(i=secstart[s]; i<secstart[s+1]; i++) {
+                int bi = (uint32_t)keys[i];
+                if (state[bi]) continue;
+                sched_blk *b = j->blk+bi;
+                int f;
+                for(f=0; f<6; f++) {
+                    int o = sched_off(j, b->x+NOFF[f][0], b->y+NOFF[f][2], b->z+NOFF[f][1]);
+                    if (o>=0 && occ[o]) break;
+                }
+                if (f==6) continue;
+                state[bi] = 1;
+                queue[qt++] = bi;
+            }
+            if (!qt) continue;
+
+            while (qh<qt) {
+                int bi = queue[qh++];
+                sched_blk *b = j->blk+bi;
+                j->order[bi] = next++;
+                occ[sched_off(j, b->x, b->y, b->z)] = 1;
+
+                // neighbors in the same section now have support too
+                int f;
+                for(f=0; f<6; f++) {
+                    int o = sched_off(j, b->x+NOFF[f][0], b->y+NOFF[f][2], b->z+NOFF[f][1]);
+                    if (o<0 || !gidx[o]) continue;
+                    int ni = gidx[o]-1;
+                    if (state[ni] || j->blk[ni].sec != s) continue;
+                    state[ni] = 1;
+                    queue[qt++] = ni;
+                }
+            }
+
+            j->route += sqrt(SQ(secx[s]-cx)+SQ(secz[s]-cz));
+            cx = secx[s]; cz = secz[s];
+            sched_stop *st = lh_arr_new(GAR(j->stops));
+            st->x = floor(secx[s]);
+            st->z = floor(secz[s]);
+            st->last = next-1;
+            progress = 1;
+        }
+    }
+
+    j->nplanned = next;
+    for(i=0; i<n; i++)
+        if (!state[i]) j->nunsupported++;
+
+    double t = j->route/SCHED_WALKSPEED + j->nplanned*j->tplace;
+    j->bpm = (t>0) ? j->nplanned*60.0/t : 0;
+
+    lh_free(queue);
+    lh_free(tour);
+    lh_free(secstart);
+    lh_free(secx);
+    lh_free(secz);
+    lh_free(keys);
+    lh_free(state);
+    lh_free(gidx);
+    lh_free(occ);
+
+    j->done = 1;
+    return NULL;
+}
+
+static void sched_job_free(sched_job *j) {
+    free_cuboid(j->c);
+    lh_free(j->blk);
+    lh_free(j->order);
+    lh_arr_free(GAR(j->stops));
+    lh_free(j);
+}
+
+// stop the planner if it's running and discard its results
+static void build_sched_abort() {
+    if (!build.sj) return;
+    build.sj->abort = 1;
+    pthread_join(build.sj->thread, NULL);
+    sched_job_free(build.sj);
+    build.sj = NULL;
+}
+
+// snapshot the buildtask and the world around it and start the planner
+static int build_sched_start() {
+    build_sched_abort();
+    if (!C(build.task)) return 0;
+
+    lh_create_obj(sched_job, j);
+    j->gen = build.gen;
+    j->n = C(build.task);
+    lh_alloc_num(j->blk, j->n);
+    lh_alloc_num(j->order, j->n);
+
+    int i;
+    for(i=0; i<j->n; i++) {
+        blk *b = P(build.task)+i;
+        j->blk[i] = (sched_blk) { b->x, b->y, b->z, b->b, 0 };
+    }
+
+    extent_t ex = { { build.xmin-1, MAX(build.ymin-1,0), build.zmin-1 },
+                    { build.xmax+1, MIN(build.ymax+1,255), build.zmax+1 } };
+    j->c = export_cuboid_extent(ex);
+    j->xmin = ex.min.x; j->ymin = ex.min.y; j->zmin = ex.min.z;
+    j->sx = j->c.sr.x;  j->sy = j->c.sr.y;  j->sz = j->c.sr.z;
+
+    j->px = gs.own.x;
+    j->pz = gs.own.z;
+    j->tplace = (double)buildopts.bldint/1000000/MAX(buildopts.blkmax,1);
+
+    if (pthread_create(&j->thread, NULL, build_sched_worker, j)) {
+        sched_job_free(j);
+        return 0;
+    }
+    build.sj = j;
+    return 1;
+}
+
+// adopt the planner results once they are ready
+static void build_sched_poll(MCPacketQueue *cq) {
+    if (!build.sj || !build.sj->done) return;
+
+    sched_job *j = build.sj;
+    pthread_join(j->thread, NULL);
+    build.sj = NULL;
+
+    if (j->gen == build.gen) {
+        int i;
+        for(i=0; i<j->n; i++)
+            P(build.task)[i].order = j->order[i];
+
+        build.sched = 1;
+        build.sched_planned = j->nplanned;
+        build.sched_unsupported = j->nunsupported;
+        build.sched_route = j->route;
+        build.sched_bpm = j->bpm;
+
+        lh_arr_free(GAR(build.stops));
+        P(build.stops) = P(j->stops);
+        C(build.stops) = C(j->stops);
+        P(j->stops) = NULL;
+        C(j->stops) = 0;
+
+        char reply[256];
+        sprintf(reply, "Schedule ready: %d blocks, %d in place, %d unsupported, "
+                "route %.0f blocks, %.0f blocks/min",
+                build.sched_planned, j->nplaced, build.sched_unsupported,
+                build.sched_route, build.sched_bpm);
+        if (cq) chat_message(reply, cq, "green", 0);
+    }
+
+    sched_job_free(j);
+}
+
+// print the schedule state and the remaining time estimate
+static void build_sched_status(char *reply) {
+    if (build.sj) {
+        sprintf(reply, "Schedule is being computed");
+        return;
+    }
+    if (!build.sched) {
+        sprintf(reply, "No schedule, use #build schedule");
+        return;
+    }
+
+    if (!build.ms_valid) build_stats_recompute();
+    int remaining = C(build.task)-build.ms_placed;
+
+    // the next stop is the one where the earliest unplaced block is placed from
+    int i, first=-1;
+    for(i=0; i<C(build.task); i++) {
+        blk *b = P(build.task)+i;
+        if (!b->done && b->order>=0 && (first<0 || b->order<first))
+            first = b->order;
+    }
+
+    int rlen = sprintf(reply, "Schedule: %d blocks, %d unsupported, route %.0f blocks, "
+                       "%.0f blocks/min, %d remaining",
+                       build.sched_planned, build.sched_unsupported,
+                       build.sched_route, build.sched_bpm, remaining);
+    if (build.sched_bpm > 0)
+        rlen += sprintf(reply+rlen, ", ETA %.1f min", remaining/build.sched_bpm);
+
+    if (first>=0) {
+        for(i=0; i<C(build.stops); i++) {
+            sched_stop *st = P(build.stops)+i;
+            if (st->last < first) continue;
+            sprintf(reply+rlen, ", next stop %d,%d", st->x, st->z);
+            break;
+        }
+    }
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Placement pipeline
+
+// Placements are tracked until the server confirms or rejects them with a
+// block update. The number of unconfirmed placements is limited by the
+// window option, and with the adaptive option the interval between the
+// placements grows when the server rejects blocks and gets back to bldint
+// as they are accepted again.
+
+#define PIPE_TMO_MIN     250000 // minimum time to wait for a confirmation (us)
+#define PIPE_IVL_MAXF         8 // interval can grow up to this multiple of bldint
+#define PIPE_RATE_PERIOD 2000000 // period of the placement rate measurement (us)
+
+static void build_pipe_reset() {
+    build.ninfl = 0;
+}
+
+// how long to wait for the server to confirm a placement
+static int64_t build_pipe_timeout() {
+    if (!build.nacked) return buildopts.blkint;
+    int64_t tmo = build.lat + 4*build.latdev;
+    return MIN(MAX(tmo, PIPE_TMO_MIN), buildopts.blkint);
+}
+
+// current interval between placements
+static int64_t build_pipe_interval() {
+    if (!buildopts.adaptive) return buildopts.bldint;
+    return MIN(MAX(build.ivl, buildopts.bldint), buildopts.bldint*PIPE_IVL_MAXF);
+}
+
+// register a placement we've just sent to the server
+static void build_pipe_add(int ti, uint64_t ts) {
+    blk *b = P(build.task)+ti;
+    b->pending = 1;
+
+    inflight_t *f = build.infl+build.ninfl++;
+    f->x = b->x;
+    f->y = b->y;
+    f->z = b->z;
+    f->ti = ti;
+    f->ts = ts;
+}
+
+// remove an in-flight placement, outcome: 1-accepted 0-rejected -1-expired
+static void build_pipe_done(int i, int outcome, uint64_t ts) {
+    inflight_t *f = build.infl+i;
+    blk *b = P(build.task)+f->ti;
+    b->pending = 0;
+
+    if (outcome > 0) {
+        // smoothed latency and deviation, same as the TCP RTT estimator
+        double l = ts-f->ts;
+        if (!build.nacked) {
+            build.lat = l;
+            build.latdev = l/2;
+        }
+        else {
+            build.latdev += (fabs(l-build.lat)-build.latdev)/4;
+            build.lat += (l-build.lat)/8;
+        }
+
+        b->placed = 1;
+        b->empty = 0;
+        build.nacked++;
+        build.rate_n++;
+    }
+    else if (outcome == 0) {
+        build.nrejected++;
+    }
+    else {
+        build.nexpired++;
+    }
+    build.rej += ((outcome > 0 ? 0 : 1) - build.rej)/16;
+
+    if (buildopts.adaptive) {
+        int64_t ivl = build_pipe_interval();
+        if (outcome > 0)
+            build.ivl = ivl - buildopts.bldint/8;
+        else
+            build.ivl = ivl*2;
+    }
+
+    build.infl[i] = build.infl[--build.ninfl];
+}
+
+// a block update from the server - check if it answers one of our placements
+static void build_pipe_ack(int32_t x, int32_t y, int32_t z, bid_t bl) {
+    int i;
+    for(i=0; i<build.ninfl; i++) {
+        inflight_t *f = build.infl+i;
+        if (f->x!=x || f->y!=y || f->z!=z) continue;
+        build_pipe_done(i, block_in_place(P(build.task)+f->ti, bl), gettimestamp());
+        return;
+    }
+}
+
+// give up on placements the server did not answer in time
+static void build_pipe_expire(uint64_t ts) {
+    int64_t tmo = build_pipe_timeout();
+    int i;
+    for(i=build.ninfl-1; i>=0; i--)
+        if (ts-build.infl[i].ts > tmo)
+            build_pipe_done(i, -1, ts);
+}
+
+// update the effective placement rate
+static void build_pipe_rate(uint64_t ts) {
+    if (!build.rate_ts) {
+        build.rate_ts = ts;
+        build.rate_n = 0;
+        return;
+    }
+    if (ts-build.rate_ts < PIPE_RATE_PERIOD) return;
+
+    build.bps = build.rate_n*1000000.0/(ts-build.rate_ts);
+    build.rate_ts = ts;
+    build.rate_n = 0;
+}
+
+static void build_pipe_status(char *reply) {
+    sprintf(reply, "Pipeline: %d in flight, interval %.0fms, latency %.0f+-%.0fms, "
+            "rejected %.0f%%, %.1f blocks/s (%d confirmed, %d rejected, %d expired)",
+            build.ninfl, build_pipe_interval()/1000.0, build.lat/1000, build.latdev/1000,
+            build.rej*100, build.bps, build.nacked, build.nrejected, build.nexpired);
+}
 
 
 
@@ -511,11 +1331,19 @@ static inline int count_dots(blk *b) {
     return c;
 }
 
-// predicate function to sort the blocks by their distance to the player
+// predicate function to sort the blocks by their distance to the player,
+// or by their position in the placement schedule if there is one
 static int sort_blocks(const void *a, const void *b) {
     int ia = *((int *)a);
     int ib = *((int *)b);
 
+    if (build.sched) {
+        // unscheduled blocks go last
+        uint32_t oa = P(build.task)[ia].order;
+        uint32_t ob = P(build.task)[ib].order;
+        if (oa != ob) return (oa<ob) ? -1 : 1;
+    }
+
     if (P(build.task)[ia].dist > P(build.task)[ib].dist) return -1;
     if (P(build.task)[ia].dist < P(build.task)[ib].dist) return 1;
 
@@ -548,8 +1376,7 @@ static void build_update_placed() {
         bid_t *slice = c.data[b->y-build.ymin]+c.boff;
         bid_t *row = slice+(b->z-build.zmin)*c.sa.x;
         bid_t bl = row[b->x-build.xmin];
-        int smask = (ITEMS[b->b.bid].flags&I_STATE_MASK)^15;
-        b->placed = (bl.bid == b->b.bid && (bl.meta&smask)==(b->b.meta&smask) );
+        b->placed = block_in_place(b, bl);
         b->empty  = ISEMPTY(bl.bid) && !b->placed;
         b->current = bl;
     }
@@ -1192,31 +2019,46 @@ static int choose_dot(blk *b, int8_t *face, int8_t *cx, int8_t *cy, int8_t *cz)
 }
 
 // asynchronous building method - check the buildqueue and try to build up to maxbld blocks
-void build_progress(MCPacketQueue *sq, MCPacketQueue *cq) {
+// returns the time of the next placement attempt, 0 if building is idle
+uint64_t build_progress(MCPacketQueue *sq, MCPacketQueue *cq) {
+    build_sched_poll(cq);
+
+    uint64_t ts = gettimestamp();
+    uint64_t idle = build.sj ? ts+SCHED_POLL : 0;
+
     // time update - try to build any blocks from the placeable blocks list
-    if (!build.active) return;
+    if (!build.active) {
+        build.rate_ts = 0;
+        return idle;
+    }
+
+    build_pipe_expire(ts);
+    build_pipe_rate(ts);
 
     // do not attempt to build while jumping or falling (i.e. feet not on ground)
-    if (!(gs.own.onground || buildopts.bjump)) return;
+    if (!(gs.own.onground || buildopts.bjump)) return idle;
 
-    uint64_t ts = gettimestamp();
+    uint64_t next = build.lastbuild+build_pipe_interval();
+    if (ts < next) return next;
+    next = ts+build_pipe_interval();
 
-    if (ts < build.lastbuild+buildopts.bldint) return;
+    int window = buildopts.window>0 ? MIN(buildopts.window, MAXINFLIGHT) : MAXINFLIGHT;
 
     int i, bc=0;
     int held=gs.inv.held;
 
-    for(i=0; i<build.nbq && bc<buildopts.blkmax; i++) {
+    for(i=0; i<build.nbq && bc<buildopts.blkmax && build.ninfl<window; i++) {
         char buf[4096];
         char buf2[4096];
 
         blk *b = P(build.task)+build.bq[i];
+        if (b->pending || b->placed) continue;
         if (ts-b->last < buildopts.blkint) continue;
 
         // fetch block's material into quickbar slot
         int islot = prefetch_material(sq, cq, get_base_material(b->b));
         if (islot==-1) continue; // we don't have this material
-        if (islot==-2) return; // inventory action is in progress, postpone building
+        if (islot==-2) return idle; // inventory action is in progress, postpone building
         //TODO: notify user about missing materials
 
         // silently switch to this slot
@@ -1364,12 +2206,15 @@ void build_progress(MCPacketQueue *sq, MCPacketQueue *cq) {
         b->last = ts;
         build.lastbuild = ts;
         mat_last[islot] = ts;
+        build_pipe_add(build.bq[i], ts);
         bc++;
     }
 
     // switch back to whatever the client was holding
     if (held != gs.inv.held)
         gmi_change_held(sq, cq, held, 0);
+
+    return next;
 }
 
 void build_pause() {
@@ -1430,6 +2275,7 @@ int build_tload(const char *name) {
 
     update_boundary();
     build_update_placed();
+    build_stats_reset();
 
     return 1;
 }
@@ -1450,6 +2296,7 @@ void place_pivot(pivot_t pv, MCPacketQueue *sq, MCPacketQueue *cq) {
     }
 
     // create a new buildtask from our buildplan
+    bplan_sync(build.bp);
     int i, trimmed=0;
     for(i=0; i<C(build.bp->plan); i++) {
         blkr bp=rel2abs(pv, P(build.bp->plan)[i]);
@@ -1472,6 +2319,7 @@ void place_pivot(pivot_t pv, MCPacketQueue *sq, MCPacketQueue *cq) {
         // store the coordinates and direction so they can be reused for 'place again'
         build.pv = pv;
         update_boundary();
+        build_stats_reset();
         build_update();
         build_tsave(DEFAULT_TASK_FILENAME);
     }
@@ -1556,6 +2404,7 @@ static void brec_blockupdate_blk(blkr b) {
 
             // add the block to the buildplan
             bplan_add(build.bp, abs2rel(build.pv, b));
+            build.ps_valid = 0;
             return;
         }
     }
@@ -1563,6 +2412,7 @@ static void brec_blockupdate_blk(blkr b) {
 
 // handler for the SP_BlockChange and SP_MultiBlockChange messages from the server
 // dispatch each updated block to brec_blockupdate_blk()
+// buildplan extents are maintained by bplan_add, no need for bplan_update here
 static void brec_blockupdate(MCPacket *pkt) {
     switch(pkt->pid) {
         case SP_BlockChange:
@@ -1571,7 +2421,6 @@ static void brec_blockupdate(MCPacket *pkt) {
                 blkr b = { tpkt->pos.x,tpkt->pos.y,tpkt->pos.z,tpkt->block };
                 brec_blockupdate_blk(b);
             }
-            bplan_update(build.bp);
             break;
         case SP_MultiBlockChange: {
             SP_MultiBlockChange_pkt *tpkt = &pkt->_SP_MultiBlockChange;
@@ -1581,7 +2430,6 @@ static void brec_blockupdate(MCPacket *pkt) {
                 blkr b = { ((tpkt->X)<<4)+br->x,br->y,((tpkt->Z)<<4)+br->z,br->bid };
                 brec_blockupdate_blk(b);
             }
-            bplan_update(build.bp);
             break;
         }
     }
@@ -1803,85 +2651,312 @@ void build_dump_queue() {
 #define PREVIEW_TRUE    2
 #define PREVIEW_REMOVE_NOQUEUE  3
 
-void build_show_preview(MCPacketQueue *sq, MCPacketQueue *cq, int mode) {
-    if (C(build.task)<=0) return;
-    build_update_placed();
+// buildtask blocks located in one chunk
+struct pvchunk {
+    int32_t X,Z;
+    int32_t off, n;             // range of block indices in build.pvbi
+    MCPacket *queued;           // preview packet for this chunk waiting in the queue
+};
 
-    int npackets=0;
-    MCPacket *packets[1000];
-    lh_clear_obj(packets);
+static inline uint32_t pv_hash(int32_t X, int32_t Z) {
+    return ((uint32_t)X*73856093u) ^ ((uint32_t)Z*83492791u);
+}
 
-    int i,j;
+static void build_preview_free() {
+    lh_arr_free(GAR(build.pvc));
+    lh_free(build.pvbi);
+    lh_free(build.pvidx);
+    build.pvsize = 0;
+    build.pvgen = 0;
+}
+
+static pvchunk * find_pvchunk(int32_t X, int32_t Z) {
+    if (!build.pvidx) return NULL;
+    uint32_t mask = build.pvsize-1;
+    uint32_t h = pv_hash(X,Z)&mask;
+    for(; build.pvidx[h]; h=(h+1)&mask) {
+        pvchunk *pc = P(build.pvc)+build.pvidx[h]-1;
+        if (pc->X==X && pc->Z==Z)
+            return pc;
+    }
+    return NULL;
+}
+
+// group the buildtask blocks by chunk - done once per buildtask
+static void build_preview_index() {
+    if (build.pvgen == build.gen && build.pvidx) return;
+    build_preview_free();
+
+    int i;
+    build.pvsize = 256;
+    while(build.pvsize < 2*C(build.task)) build.pvsize <<= 1;
+    lh_alloc_num(build.pvidx, build.pvsize);
+    uint32_t mask = build.pvsize-1;
+
+    // count the blocks in each chunk, remember which chunk every block is in
+    lh_create_num(int32_t, ci, C(build.task));
     for(i=0; i<C(build.task); i++) {
-        blk *b = &P(build.task)[i];
-        if (build.limit && b->y>build.limit) continue;
-        if (b->placed) continue;
-
-        int32_t X=b->x>>4;
-        int32_t Z=b->z>>4;
-
-        // skip blocks located in unloaded chunks
-        gschunk *gc = find_chunk(gs.world, X, Z, 0);
-        if (!gc) continue;
-
-        // see if we already have a packet for this chunk prepared
-        SP_MultiBlockChange_pkt *tpkt=NULL;
-        for(j=0; j<npackets; j++) {
-            if (packets[j]->_SP_MultiBlockChange.X==X &&
-                packets[j]->_SP_MultiBlockChange.Z==Z) {
-                tpkt = &packets[j]->_SP_MultiBlockChange;
-                break;
-            }
+        blk *b = P(build.task)+i;
+        int32_t X=b->x>>4, Z=b->z>>4;
+        uint32_t h = pv_hash(X,Z)&mask;
+        for(; build.pvidx[h]; h=(h+1)&mask) {
+            pvchunk *pc = P(build.pvc)+build.pvidx[h]-1;
+            if (pc->X==X && pc->Z==Z) break;
+        }
+        if (!build.pvidx[h]) {
+            pvchunk *pc = lh_arr_new_c(GAR(build.pvc));
+            pc->X = X;
+            pc->Z = Z;
+            build.pvidx[h] = C(build.pvc);
         }
+        ci[i] = build.pvidx[h]-1;
+        P(build.pvc)[ci[i]].n++;
+    }
+
+    int off=0;
+    for(i=0; i<C(build.pvc); i++) {
+        P(build.pvc)[i].off = off;
+        off += P(build.pvc)[i].n;
+        P(build.pvc)[i].n = 0;
+    }
+
+    lh_alloc_num(build.pvbi, C(build.task));
+    for(i=0; i<C(build.task); i++) {
+        pvchunk *pc = P(build.pvc)+ci[i];
+        build.pvbi[pc->off+pc->n++] = i;
+    }
+    lh_free(ci);
+
+    build.pvgen = build.gen;
+}
+
+// the client got a real block at this position - phantom block is gone
+static void build_preview_block(int32_t x, int32_t y, int32_t z) {
+    blk *b = find_task_block(x,y,z);
+    if (b) b->pvshown = 0;
+}
+
+// the client got a new copy of this chunk - all phantom blocks in it are gone
+static void build_preview_chunk(int32_t X, int32_t Z) {
+    if (build.pvgen != build.gen) return;
+    pvchunk *pc = find_pvchunk(X,Z);
+    if (!pc) return;
+    int i;
+    for(i=0; i<pc->n; i++)
+        P(build.task)[build.pvbi[pc->off+i]].pvshown = 0;
+}
+
+// merge the blocks of a newer preview packet into the queued one for the same
+// chunk, blocks at the same position are overwritten with the newer value
+static void preview_merge(SP_MultiBlockChange_pkt *dst, SP_MultiBlockChange_pkt *src) {
+    static int32_t pos[65536]; // chunk position -> dst block index+1
+    int i;
 
-        // no such packet - make new
-        if (!tpkt) {
-            if (npackets >= 1000) continue; // too many packets already - skip it
-            NEWPACKET(SP_MultiBlockChange, mbc);
-            packets[npackets++] = mbc;
-            tpkt = tmbc;
-            tmbc->X = X;
-            tmbc->Z = Z;
+#define PVPOS(br) ((br)->x | ((br)->z<<4) | ((br)->y<<8))
+    for(i=0; i<dst->count; i++)
+        pos[PVPOS(dst->blocks+i)] = i+1;
+
+    lh_resize(dst->blocks, dst->count+src->count);
+    for(i=0; i<src->count; i++) {
+        blkrec *br = src->blocks+i;
+        int32_t *p = pos+PVPOS(br);
+        if (*p) {
+            dst->blocks[*p-1].bid = br->bid;
+            build.pvq_blocks--;
+        }
+        else {
+            dst->blocks[dst->count] = *br;
+            *p = ++dst->count;
         }
+    }
+
+    for(i=0; i<dst->count; i++)
+        pos[PVPOS(dst->blocks+i)] = 0;
+#undef PVPOS
+}
 
-        // depending on the preview mode, select which block will be shown
+// which block should the client see at the position of b, returns 0 if the
+// preview should not be shown there
+static inline int preview_want(blk *b, int mode, bid_t *bid) {
+    if (mode==PREVIEW_REMOVE || mode==PREVIEW_REMOVE_NOQUEUE) return 0;
+    if (build.limit && b->y>build.limit) return 0;
+    if (b->placed) return 0;
+    *bid = (mode==PREVIEW_MISSING) ? PREVIEW_BLOCK : b->b;
+    return 1;
+}
+
+// send the client the difference between the preview it's currently
+// showing and the one requested - only blocks that have changed are sent
+void build_show_preview(MCPacketQueue *sq, MCPacketQueue *cq, int mode) {
+    if (C(build.task)<=0) return;
+    build_update_placed();
+    build_preview_index();
+
+    if (mode==PREVIEW_REMOVE_NOQUEUE) {
+        // drop the preview still waiting in the queue, we restore all blocks now
+        int i;
+        for(i=0; i<C(build.preview_queue.queue); i++)
+            free_packet(P(build.preview_queue.queue)[i]);
+        lh_arr_free(GAR(build.preview_queue.queue));
+        for(i=0; i<C(build.pvc); i++)
+            P(build.pvc)[i].queued = NULL;
+        build.pvq_blocks = 0;
+    }
+
+    int i,j,npackets=0;
+    for(i=0; i<C(build.pvc); i++) {
+        pvchunk *pc = P(build.pvc)+i;
+
+        // skip blocks located in chunks the client has not loaded - the
+        // chunks paged in from an archive are only known to us
+        gschunk *gc = peek_chunk(gs.world, pc->X, pc->Z);
+        if (!gc || gc->paged) continue;
+
+        // count the changed blocks first, so the packet is allocated once
+        int count=0;
         bid_t bid;
-        switch (mode) {
-            case PREVIEW_REMOVE:
-            case PREVIEW_REMOVE_NOQUEUE:
-                bid = b->current;
-                break;
-            case PREVIEW_MISSING:
-                bid = PREVIEW_BLOCK;
-                break;
-            case PREVIEW_TRUE:
-                bid = b->b;
-                break;
+        for(j=0; j<pc->n; j++) {
+            blk *b = P(build.task)+build.pvbi[pc->off+j];
+            if (preview_want(b, mode, &bid)) {
+                if (!b->pvshown || b->pvb.raw!=bid.raw) count++;
+            }
+            else if (b->pvshown) {
+                count++;
+            }
         }
+        if (!count) continue;
 
-        // add new block to the packet
-        lh_resize(tpkt->blocks, tpkt->count+1);
-        tpkt->blocks[tpkt->count].x = b->x&15;
-        tpkt->blocks[tpkt->count].z = b->z&15;
-        tpkt->blocks[tpkt->count].y = b->y;
-        tpkt->blocks[tpkt->count].bid = bid;
-        tpkt->count++;
-    }
+        NEWPACKET(SP_MultiBlockChange, mbc);
+        tmbc->X = pc->X;
+        tmbc->Z = pc->Z;
+        lh_alloc_num(tmbc->blocks, count);
+
+        for(j=0; j<pc->n; j++) {
+            blk *b = P(build.task)+build.pvbi[pc->off+j];
+            if (preview_want(b, mode, &bid)) {
+                if (b->pvshown && b->pvb.raw==bid.raw) continue;
+                b->pvshown = 1;
+                b->pvb = bid;
+            }
+            else {
+                if (!b->pvshown) continue;
+                bid = b->current; // restore the real block
+                b->pvshown = 0;
+            }
 
-    for(i=0; i<npackets; i++)
-        queue_packet(packets[i], (mode==PREVIEW_REMOVE_NOQUEUE) ? cq : &build.preview_queue);
+            blkrec *br = tmbc->blocks+tmbc->count++;
+            br->x = b->x&15;
+            br->z = b->z&15;
+            br->y = b->y;
+            br->bid = bid;
+        }
+
+        if (mode==PREVIEW_REMOVE_NOQUEUE) {
+            queue_packet(mbc, cq);
+        }
+        else {
+            // coalesce with the packet for this chunk if one is still queued
+            build.pvq_blocks += tmbc->count;
+            if (pc->queued) {
+                preview_merge(&pc->queued->_SP_MultiBlockChange, tmbc);
+                free_packet(mbc);
+                continue;
+            }
+            queue_packet(mbc, &build.preview_queue);
+            pc->queued = mbc;
+        }
+        npackets++;
+    }
 
     //printf("Created %d packets\n",npackets);
 }
 
-// rate-limited sending of preview packets to the client
+// rate-limited sending of preview packets to the client - the rate follows
+// how fast the client connection drains, chunks nearest to the player go first
+#define PREVIEW_MAXBACKLOG 65536    // max bytes queued towards the client
+#define PREVIEW_MAXBURST   32       // max packets sent at once
+#define PREVIEW_RATE_PERIOD 1000000 // period of the throughput measurement (us)
+#define PREVIEW_RETRY      20000    // recheck interval while the client is backlogged
+
+// fallback if the client backlog can't be measured
 #define PREVIEW_MAXPACKETS 5
 #define PREVIEW_INTERVAL   200000
 
 TBDEF(tb_preview, PREVIEW_INTERVAL, PREVIEW_MAXPACKETS);
 
-void build_preview_transmit(MCPacketQueue *cq) {
-    packet_queue_transmit(cq, &build.preview_queue, &tb_preview);
+// index of the queued preview packet closest to the player - the first one
+// wins among equals, so the packets for the same chunk keep their order
+static int preview_nearest() {
+    int32_t PX = ((int32_t)floor(gs.own.x))>>4;
+    int32_t PZ = ((int32_t)floor(gs.own.z))>>4;
+
+    int i, best=-1;
+    int64_t bd=0;
+    for(i=0; i<C(build.preview_queue.queue); i++) {
+        SP_MultiBlockChange_pkt *tpkt = &P(build.preview_queue.queue)[i]->_SP_MultiBlockChange;
+        int64_t d = SQ((int64_t)(tpkt->X-PX)) + SQ((int64_t)(tpkt->Z-PZ));
+        if (best<0 || d<bd) {
+            best = i;
+            bd = d;
+        }
+    }
+    return best;
+}
+
+// returns the time when the queue should be serviced again, 0 if it's empty
+uint64_t build_preview_transmit(MCPacketQueue *cq) {
+    uint64_t ts = gettimestamp();
+    if (ts-build.pvrate_ts >= PREVIEW_RATE_PERIOD) {
+        build.pvbps = build.pvrate_n*1000000.0/(ts-build.pvrate_ts);
+        build.pvrate_ts = ts;
+        build.pvrate_n = 0;
+    }
+
+    if (!C(build.preview_queue.queue)) return 0;
+
+    ssize_t backlog = client_backlog();
+    build.pvbacklog = backlog;
+
+    uint64_t next = ts; // burst limit reached - continue right away
+    int n;
+    for(n=0; n<PREVIEW_MAXBURST && C(build.preview_queue.queue); n++) {
+        int i = preview_nearest();
+        MCPacket *pkt = P(build.preview_queue.queue)[i];
+        SP_MultiBlockChange_pkt *tpkt = &pkt->_SP_MultiBlockChange;
+
+        if (backlog >= 0) {
+            if (backlog >= PREVIEW_MAXBACKLOG) {
+                next = ts+PREVIEW_RETRY;
+                break;
+            }
+            backlog += 16+5*tpkt->count; // estimated encoded size
+        }
+        else if (!tb_event(&tb_preview, 1)) {
+            next = tb_due(&tb_preview, 1);
+            break;
+        }
+
+        if (build.pvgen == build.gen) {
+            pvchunk *pc = find_pvchunk(tpkt->X, tpkt->Z);
+            if (pc && pc->queued == pkt) pc->queued = NULL;
+        }
+
+        build.pvq_blocks -= tpkt->count;
+        build.pv_sent += tpkt->count;
+        build.pvrate_n += tpkt->count;
+
+        lh_arr_delete(GAR(build.preview_queue.queue), i);
+        queue_packet(pkt, cq);
+    }
+
+    return C(build.preview_queue.queue) ? next : 0;
+}
+
+static void build_preview_status(char *reply) {
+    int rlen = sprintf(reply, "Preview: %zd packets (%d blocks) queued, %.0f blocks/s, %d sent",
+                       C(build.preview_queue.queue), build.pvq_blocks, build.pvbps, build.pv_sent);
+    if (build.pvbacklog >= 0)
+        sprintf(reply+rlen, ", client backlog %zd bytes", build.pvbacklog);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -1891,6 +2966,7 @@ void build_preview_transmit(MCPacketQueue *cq) {
 void build_clear(MCPacketQueue *sq, MCPacketQueue *cq) {
     build_cancel(sq, cq);
     bplan_free(build.bp);
+    lh_arr_free(GAR(build.ps));
     lh_clear_obj(build);
 
     if (!buildopts.init)
@@ -1903,6 +2979,8 @@ void build_cancel(MCPacketQueue *sq, MCPacketQueue *cq) {
         build_show_preview(sq, cq, PREVIEW_REMOVE_NOQUEUE);
     build.active = 0;
     lh_arr_free(BTASK);
+    build_stats_reset();
+    build_preview_free();
     build.bq[0] = -1;
     build.nbrp = 0; // clear the pending queue
     buildopts.sealmode = 0; // always cancel seal mode
@@ -1945,7 +3023,7 @@ static void get_argdefaults(arg_defaults *ad) {
 #define CMD(name) if (!strcmp(cmd, #name))
 #define CMD2(name1,name2) if (!strcmp(cmd, #name1) || !strcmp(cmd, #name2))
 
-#define NEEDBP if (!build.bp || !C(build.bp->plan)) {                          \
+#define NEEDBP if (!build.bp || !bplan_count(build.bp)) {                      \
         sprintf(reply, "You need a non-empty buildplan for this command");     \
         goto Error;                                                            \
     }
@@ -2165,7 +3243,7 @@ void build_cmd(char **words, MCPacketQueue *sq, MCPacketQueue *cq) {
         int flat = argflag(words, WORDLIST("flat","2d","2","f","xz"));
         int opaque = !argflag(words, WORDLIST("opaque","o"));
         int removed = bplan_hollow(build.bp, flat, opaque);
-        sprintf(reply, "Removed %d blocks, kept %zd",removed,C(build.bp->plan));
+        sprintf(reply, "Removed %d blocks, kept %zd",removed,bplan_count(build.bp));
         goto Place;
     }
 
@@ -2207,7 +3285,7 @@ void build_cmd(char **words, MCPacketQueue *sq, MCPacketQueue *cq) {
         }
 
         sprintf(reply, "Trim: removed %d blocks, retained %zd",
-                removed, C(build.bp->plan));
+                removed, bplan_count(build.bp));
 
         goto Place;
     }
@@ -2263,7 +3341,7 @@ void build_cmd(char **words, MCPacketQueue *sq, MCPacketQueue *cq) {
         NEEDBP;
         bplan_shrink(build.bp);
         sprintf(reply, "Shrunk to %zd blocks in a %dx%dx%d area\n",
-                C(build.bp->plan), build.bp->sx, build.bp->sz, build.bp->sy);
+                bplan_count(build.bp), build.bp->sx, build.bp->sz, build.bp->sy);
         goto Place;
     }
 
@@ -2272,7 +3350,7 @@ void build_cmd(char **words, MCPacketQueue *sq, MCPacketQueue *cq) {
         ARGDEF(count, NULL, count, 2);
         bplan_scale(build.bp, count);
         sprintf(reply, "Scale %d times to %zd blocks in a %dx%dx%d area\n",
-                count, C(build.bp->plan), build.bp->sx, build.bp->sz, build.bp->sy);
+                count, bplan_count(build.bp), build.bp->sx, build.bp->sz, build.bp->sy);
         goto Place;
     }
 
@@ -2288,7 +3366,7 @@ void build_cmd(char **words, MCPacketQueue *sq, MCPacketQueue *cq) {
             sprintf(reply, "Error saving to %s.bplan",words[0]);
         else
             sprintf(reply, "Saved %zd blocks to %s.bplan\n",
-                    C(build.bp->plan),words[0]);
+                    bplan_count(build.bp),words[0]);
 
         goto Error;
     }
@@ -2346,7 +3424,7 @@ void build_cmd(char **words, MCPacketQueue *sq, MCPacketQueue *cq) {
             sprintf(reply, "Error saving to %s.schematic",words[0]);
         else
             sprintf(reply, "Saved %zd blocks to %s.schematic\n",
-                    C(build.bp->plan),words[0]);
+                    bplan_count(build.bp),words[0]);
 
         goto Error;
     }
@@ -2381,7 +3459,7 @@ void build_cmd(char **words, MCPacketQueue *sq, MCPacketQueue *cq) {
             sprintf(reply, "Error saving to %s.csv",words[0]);
         else
             sprintf(reply, "Saved %zd blocks to %s.csv\n",
-                    C(build.bp->plan),words[0]);
+                    bplan_count(build.bp),words[0]);
 
         goto Error;
     }
@@ -2555,8 +3633,35 @@ void build_cmd(char **words, MCPacketQueue *sq, MCPacketQueue *cq) {
         goto Error;
     }
 
+    CMD2(schedule,sched) {
+        if (words[0] && !strcmp(words[0],"status")) {
+            build_sched_status(reply);
+        }
+        else if (words[0] && !strcmp(words[0],"off")) {
+            build_sched_abort();
+            build.sched = 0;
+            sprintf(reply, "Schedule disabled");
+        }
+        else if (build_sched_start()) {
+            sprintf(reply, "Computing schedule for %zd blocks", C(build.task));
+        }
+        else {
+            sprintf(reply, "You need an existing buildtask to schedule");
+        }
+        goto Error;
+    }
+
+    CMD2(pipeline,pipe) {
+        build_pipe_status(reply);
+        goto Error;
+    }
+
     // Preview
     CMD(preview) {
+        if (argflag(words, WORDLIST("status","s"))) {
+            build_preview_status(reply);
+            goto Error;
+        }
         int mode = PREVIEW_MISSING;
         if (argflag(words, WORDLIST("true","t"))) mode=PREVIEW_TRUE;
         if (argflag(words, WORDLIST("remove","r"))) mode=PREVIEW_REMOVE;
@@ -2615,6 +3720,7 @@ void build_cmd(char **words, MCPacketQueue *sq, MCPacketQueue *cq) {
 
  Place:
     bplan_update(build.bp);
+    build.ps_valid = 0;
     build.placemode = buildopts.placemode; // initiate placing
     size_t rlen = strlen(reply);
     switch(build.placemode) {
@@ -2634,6 +3740,37 @@ void build_cmd(char **words, MCPacketQueue *sq, MCPacketQueue *cq) {
 
 // dispatch for the building-relevant packets we get from mcp_game
 int build_packet(MCPacket *pkt, MCPacketQueue *sq, MCPacketQueue *cq) {
+    // keep the material stats of the buildtask up to date
+    // and match block updates against our pending placements
+    if (C(build.task)) {
+        switch (pkt->pid) {
+            case SP_BlockChange: {
+                SP_BlockChange_pkt *tpkt = &pkt->_SP_BlockChange;
+                build_stats_block(tpkt->pos.x, tpkt->pos.y, tpkt->pos.z, tpkt->block);
+                build_preview_block(tpkt->pos.x, tpkt->pos.y, tpkt->pos.z);
+                if (build.ninfl)
+                    build_pipe_ack(tpkt->pos.x, tpkt->pos.y, tpkt->pos.z, tpkt->block);
+                break;
+            }
+            case SP_MultiBlockChange: {
+                SP_MultiBlockChange_pkt *tpkt = &pkt->_SP_MultiBlockChange;
+                int i;
+                for(i=0; i<tpkt->count; i++) {
+                    blkrec *br = tpkt->blocks+i;
+                    int32_t x = (tpkt->X<<4)+br->x, z = (tpkt->Z<<4)+br->z;
+                    build_stats_block(x, br->y, z, br->bid);
+                    build_preview_block(x, br->y, z);
+                    if (build.ninfl)
+                        build_pipe_ack(x, br->y, z, br->bid);
+                }
+                break;
+            }
+            case SP_Explosion:
+                build.ms_valid = 0;
+                break;
+        }
+    }
+
     if (pkt->pid == SP_UpdateHealth && gs.own.health < 20) {
         if (build.active) {
             build.active = 0;
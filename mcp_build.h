@@ -32,9 +32,10 @@ void build_clear(MCPacketQueue *sq, MCPacketQueue *cq);
 void build_cancel(MCPacketQueue *sq, MCPacketQueue *cq);
 void build_pause();
 void build_update();
-void build_progress(MCPacketQueue *sq, MCPacketQueue *cq);
+uint64_t build_progress(MCPacketQueue *sq, MCPacketQueue *cq);
 int  build_packet(MCPacket *pkt, MCPacketQueue *sq, MCPacketQueue *cq);
-void build_preview_transmit(MCPacketQueue *cq);
+uint64_t build_preview_transmit(MCPacketQueue *cq);
+void build_chunk_update(int32_t X, int32_t Z);
 
 void build_sload(const char *name, char *reply);
 void build_dump_plan();
@@ -1205,6 +1205,7 @@ void gm_packet(MCPacket *pkt, MCPacketQueue *tq, MCPacketQueue *bq) {
 
             build_update();
 
+            hud_blocks_update(pkt);
             hud_invalidate(HUDINV_BLOCKS|HUDINV_POSITION);
 
             gs.own.pos_change = 0;
@@ -1237,10 +1238,18 @@ void gm_packet(MCPacket *pkt, MCPacketQueue *tq, MCPacketQueue *bq) {
         // World data
 
         GMP(SP_ChunkData) {
+            build_chunk_update(tpkt->chunk.X, tpkt->chunk.Z);
+            hud_chunk_update(tpkt->chunk.X, tpkt->chunk.Z);
             if (opt.xray) xray_filter(pkt);
             queue_packet(pkt, tq);
         } _GMP;
 
+        GMP(SP_UnloadChunk) {
+            build_chunk_update(tpkt->X, tpkt->Z);
+            hud_chunk_update(tpkt->X, tpkt->Z);
+            queue_packet(pkt, tq);
+        } _GMP;
+
         GMP(CP_PlayerDigging) {
             if (opt.xray && tpkt->status==0) { // start digging
                 bid_t db = get_block_at(tpkt->loc.x, tpkt->loc.z, tpkt->loc.y);
@@ -1471,10 +1480,73 @@ void read_uuids() {
 #endif
 }
 
+////////////////////////////////////////////////////////////////////////////////
+// Async task scheduler
+
+// each task returns the time it wants to run next, or 0 if it only needs to
+// run when something happens, i.e. on the next wakeup of the event loop
+
+#define ASYNC_MAXWAIT 1000000   // longest time to sleep in the event loop (us)
+#define INVQ_POLL     100000    // sleep limit while an inventory action is running
+
+typedef struct {
+    twtimer     t;              // must be the first member
+    int         fired;
+    uint64_t  (*run)(MCPacketQueue *sq, MCPacketQueue *cq);
+} gmtask;
+
+static uint64_t gmt_autokill(MCPacketQueue *sq, MCPacketQueue *cq) {
+    if (!opt.autokill) return 0;
+    autokill(sq);
+    return tb_due(&tb_ak, 1);
+}
+
+static uint64_t gmt_autoshear(MCPacketQueue *sq, MCPacketQueue *cq) {
+    if (!opt.autoshear || gs.inv.slots[gs.inv.held+36].item != 359) return 0;
+    autoshear(sq);
+    return tb_due(&tb_ash, 1);
+}
+
+static uint64_t gmt_antiafk(MCPacketQueue *sq, MCPacketQueue *cq) {
+    if (!opt.antiafk) return 0;
+    antiafk(sq, cq);
+    return tb_due(&tb_afk, 1);
+}
+
+static uint64_t gmt_preview(MCPacketQueue *sq, MCPacketQueue *cq) {
+    return build_preview_transmit(cq);
+}
+
+static uint64_t gmt_hud(MCPacketQueue *sq, MCPacketQueue *cq) {
+    return hud_update(cq);
+}
+
+static gmtask gm_tasks[] = {
+    { .run = gmt_autokill },
+    { .run = gmt_autoshear },
+    { .run = gmt_antiafk },
+    { .run = gmt_preview },
+    { .run = build_progress },
+    { .run = gmt_hud },
+};
+#define NUM_TASKS (sizeof(gm_tasks)/sizeof(gm_tasks[0]))
+
+static timerwheel gm_tw;
+
+static void gm_async_reset() {
+    int i;
+    for(i=0; i<NUM_TASKS; i++) {
+        tw_disarm(&gm_tasks[i].t);
+        gm_tasks[i].fired = 0;
+    }
+    lh_clear_obj(gm_tw);
+}
+
 void gm_reset() {
     lh_clear_obj(opt);
     clear_slot(&invq.drag);
     lh_clear_obj(invq);
+    gm_async_reset();
 
     build_clear(NULL,NULL);
     readbases();
@@ -1488,12 +1560,30 @@ void gm_async(MCPacketQueue *sq, MCPacketQueue *cq) {
         return;
     }
 
-    if (opt.autokill)  autokill(sq);
-    if (opt.autoshear) autoshear(sq);
-    if (opt.antiafk)   antiafk(sq, cq);
-    //if (opt.autoeat)   autoeat(sq, cq);
+    uint64_t ts = gettimestamp();
+    twtimer *t;
+    while ((t=tw_expired(&gm_tw, ts)))
+        ((gmtask *)t)->fired = 1;
+
+    // tasks waiting for a timer are skipped, the rest run in a fixed order
+    int i;
+    for(i=0; i<NUM_TASKS; i++) {
+        gmtask *task = &gm_tasks[i];
+        if (task->t.due && !task->fired) continue;
+        task->fired = 0;
+
+        uint64_t next = task->run(sq, cq);
+        if (next) {
+            uint64_t now = gettimestamp();
+            tw_arm(&gm_tw, &task->t, MAX(next, now+1));
+        }
+    }
+}
 
-    build_preview_transmit(cq);
-    build_progress(sq, cq);
-    hud_update(cq);
+// how long the event loop may sleep until the next task is due, in ms
+int gm_timeout() {
+    int64_t tmo = tw_timeout(&gm_tw, gettimestamp());
+    if (tmo < 0 || tmo > ASYNC_MAXWAIT) tmo = ASYNC_MAXWAIT;
+    if (invq.state && tmo > INVQ_POLL) tmo = INVQ_POLL;
+    return (tmo+999)/1000;
 }
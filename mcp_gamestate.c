@@ -55,6 +55,14 @@ void dump_entities() {
 ////////////////////////////////////////////////////////////////////////////////
 // chunk storage
 
+// chunks missing in the world can be paged in by page_chunk from an archive
+static chunk_pager gs_pager = NULL;
+static uint32_t gs_pagetick = 0;
+
+void gs_set_pager(chunk_pager pager) {
+    gs_pager = pager;
+}
+
 // return pointer to a gschunk with chunk coords X,Z
 // NULL, if chunk, or its region/superregion are not allocated
 gschunk * find_chunk(gsworld *w, int32_t X, int32_t Z, int allocate) {
@@ -86,11 +94,43 @@ gschunk * find_chunk(gsworld *w, int32_t X, int32_t Z, int allocate) {
     return chunk;
 }
 
+// like find_chunk, but a missing chunk is paged in if the pager has it.
+// Paged chunks may be dropped again, so this must only be used from the
+// main thread and the pointer not be kept past the current packet
+gschunk * page_chunk(gsworld *w, int32_t X, int32_t Z) {
+    gschunk * gc = find_chunk(w, X, Z, 0);
+    if (gc) {
+        if (gc->paged) gc->paged = ++gs_pagetick;
+        return gc;
+    }
+
+    if (!gs_pager || !gs_pager(w, X, Z, NULL)) return NULL;
+
+    gc = find_chunk(w, X, Z, 1);
+    if (!gc) return NULL;
+    if (!gs_pager(w, X, Z, gc)) {
+        drop_chunk(w, X, Z);
+        return NULL;
+    }
+    gc->paged = ++gs_pagetick;
+    return gc;
+}
+
+// return the chunk only if it's present, without paging it in
+gschunk * peek_chunk(gsworld *w, int32_t X, int32_t Z) {
+    gssreg * sreg = w->sreg[CC_2(X,Z)];
+    if (!sreg) return NULL;
+    gsregion * region = sreg->region[CC_1(X,Z)];
+    if (!region) return NULL;
+    return region->chunk[CC_0(X,Z)];
+}
+
 // add/replace chunk data, allocating storage if necessary
 // return pointer to the chunk
 static gschunk * insert_chunk(chunk_t *c, int cont) {
     gschunk * gc = find_chunk(gs.world, c->X, c->Z, 1);
     if (!gc) return NULL;
+    gc->paged = 0; // the server's data takes over
 
     int i;
     for(i=0; i<16; i++) {
@@ -111,9 +151,7 @@ static gschunk * insert_chunk(chunk_t *c, int cont) {
     return gc;
 }
 
-static void remove_chunk(int32_t X, int32_t Z) {
-    gsworld *w = gs.world;
-
+void drop_chunk(gsworld *w, int32_t X, int32_t Z) {
     int32_t si = CC_2(X,Z);
     if (!w->sreg[si]) return;
     gssreg * sreg = w->sreg[si];
@@ -130,6 +168,10 @@ static void remove_chunk(int32_t X, int32_t Z) {
     //TODO: deallocate regions/superregions that become empty
 }
 
+static void remove_chunk(int32_t X, int32_t Z) {
+    drop_chunk(gs.world, X, Z);
+}
+
 static void free_chunks(gsworld *w) {
     if (!w) return;
 
@@ -225,7 +267,7 @@ int store_tile_entity(int32_t X, int32_t Z, nbt_t *ent) {
     // uses no name (i.e. NULL) and the chunk fails to load otherwise
     if (ent->name) lh_free(ent->name);
 
-    gschunk * gc = find_chunk(gs.world, X, Z, 0);
+    gschunk * gc = peek_chunk(gs.world, X, Z);
     if (!gc) return 0;
 
     // allocate TE list if not done yet
@@ -468,7 +510,7 @@ cuboid_t export_cuboid_extent(extent_t ex) {
     for(X=Xl; X<=Xh; X++) {
         for(Z=Zl; Z<=Zh; Z++) {
             // get the chunk data
-            gschunk *gc = find_chunk(gs.world, X, Z, 0);
+            gschunk *gc = page_chunk(gs.world, X, Z);
             if (!gc) continue;
 
             // offset of this chunk's data (in blocks)
@@ -492,9 +534,10 @@ cuboid_t export_cuboid_extent(extent_t ex) {
     return c;
 }
 
-// get just a single block value at given coordinates
+// get just a single block value at given coordinates - main thread only,
+// since the chunk may be paged in
 bid_t get_block_at(int32_t x, int32_t z, int32_t y) {
-    gschunk *gc = find_chunk(gs.world, x>>4, z>>4, 0);
+    gschunk *gc = page_chunk(gs.world, x>>4, z>>4);
     if (!gc) return BLOCKTYPE(0,0);
 
     return gc->blocks[y*256+(z&15)*16+(x&15)];
@@ -525,12 +568,14 @@ int sameitem(slot_t *a, slot_t *b) {
     if (a->nbt && b->nbt) {
         // compare NBT by serializing and comparing resulting binary data
         //TODO: verify if this is sufficient or will we need a more sophisticated comparison?
-        uint8_t ba[65536], bb[65536], *wa = ba, *wb = bb;
-        nbt_write(&wa, a->nbt);
-        nbt_write(&wb, b->nbt);
-        ssize_t sa=wa-ba, sb=wb-bb;
-        if (sa!=sb) return 0; // different NBT length
-        return !memcmp(ba, bb, sa); // compare binary data
+        if (nbt_size(a->nbt) != nbt_size(b->nbt)) return 0; // different NBT length
+        ssize_t sa, sb;
+        uint8_t *ba = nbt_serialize(a->nbt, &sa);
+        uint8_t *bb = nbt_serialize(b->nbt, &sb);
+        int same = !memcmp(ba, bb, sa); // compare binary data
+        lh_free(ba);
+        lh_free(bb);
+        return same;
     }
     else
         // one item has NBT, the other does not - they are different
@@ -78,6 +78,8 @@ typedef struct {
     light_t     skylight[32768];
     uint8_t     biome[256];
     nbt_t      *tent;
+    uint32_t    paged;      // LRU stamp if the chunk was paged in from
+                            // an archive, 0 for chunks sent by the server
 } gschunk;
 
 // chunk coord -> offset within region (1x1 regions, 32x32 chunks, 512x512 blocks)
@@ -106,6 +108,10 @@ typedef struct {
     gssreg *sreg[512*512];
 } gsworld;
 
+// loads chunk X,Z of world w from an archive into gc, returns nonzero
+// on success - with gc==NULL only checks if the chunk is available
+typedef int (*chunk_pager)(gsworld *w, int32_t X, int32_t Z, gschunk *gc);
+
 ////////////////////////////////////////////////////////////////////////////////
 
 typedef struct _gamestate {
@@ -189,6 +195,10 @@ void dump_entities();
 void dump_inventory();
 
 gschunk * find_chunk(gsworld *w, int32_t X, int32_t Z, int allocate);
+gschunk * peek_chunk(gsworld *w, int32_t X, int32_t Z);
+gschunk * page_chunk(gsworld *w, int32_t X, int32_t Z);
+void drop_chunk(gsworld *w, int32_t X, int32_t Z);
+void gs_set_pager(chunk_pager pager);
 cuboid_t export_cuboid_extent(extent_t ex);
 bid_t get_block_at(int32_t x, int32_t z, int32_t y);
 int get_stored_area(gsworld *w, int32_t *Xmin, int32_t *Xmax, int32_t *Zmin, int32_t *Zmax);
@@ -2986,6 +2986,15 @@ MCPacket * decode_packet(int is_client, uint8_t *data, ssize_t len) {
     return pkt;
 }
 
+// returns true if the payload of this packet type is of interest to anyone -
+// i.e. there is a decoder for it or it should be dumped. Other packets are
+// not looked at by the gamestate or the game modules and are forwarded as is
+int packet_inspected(int is_client, int32_t rawtype) {
+    if (rawtype < 0 || rawtype >= MAXPACKETTYPES) return 1;
+    if (SUPPORT[is_client][rawtype].decode_method) return 1;
+    return is_packet_dumpable(SUPPORT[is_client][rawtype].pid);
+}
+
 //FIXME: for now we assume static buffer allocation and sufficient buffer size
 //FIXME: we should convert this to lh_buf_t or a resizeable buffer later
 ssize_t encode_packet(MCPacket *pkt, uint8_t *buf) {
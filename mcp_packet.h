@@ -621,6 +621,7 @@ typedef struct {
 extern int  currentProtocol;
 int         set_protocol(int protocol, char * reply);
 
+int         packet_inspected(int is_client, int32_t rawtype);
 MCPacket *  decode_packet(int is_client, uint8_t *p, ssize_t len);
 ssize_t     encode_packet(MCPacket *pkt, uint8_t *buf);
 void        dump_packet(MCPacket *pkt);
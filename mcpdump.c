@@ -6,6 +6,8 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <limits.h>
+#include <unistd.h>
+#include <pthread.h>
 
 #define LH_DECLARE_SHORT_NAMES 1
 
@@ -56,6 +58,8 @@ char *o_biomemap                = NULL;
 char *o_heightmap               = NULL;
 char *o_worlddir                = NULL;
 int o_flatbedrock               = 0;
+int o_block_stats               = 0;
+char *o_index                   = NULL;
 int o_reglimit                  = 0;
 int o_xmin                      = -60000;
 int o_zmin                      = -60000;
@@ -81,13 +85,15 @@ void print_usage() {
            "  -D dimension              : specify dimension (0:overworld, -1:nether, 1:end)\n"
            "  -L xmin,zmin,xmax,zmax    : limit the area from which chunks will be stored, in regions\n"
            "  -W                        : search for flat bedrock formations suitable for wither spawning\n"
+           "  -c                        : print block statistics\n"
+           "  -I index.idx              : use a block index file for the given traces - build it if it's missing or outdated\n"
     );
 }
 
 int parse_args(int ac, char **av) {
     int opt,error=0;
 
-    while ( (opt=getopt(ac,av,"b:D:B:H:A:L:sSihmdtpWe")) != -1 ) {
+    while ( (opt=getopt(ac,av,"b:D:B:H:A:L:I:sSihmdtpWec")) != -1 ) {
         switch (opt) {
             case 'h':
                 o_help = 1;
@@ -119,6 +125,12 @@ int parse_args(int ac, char **av) {
             case 'W':
                 o_flatbedrock = 1;
                 break;
+            case 'c':
+                o_block_stats = 1;
+                break;
+            case 'I':
+                o_index = optarg;
+                break;
             case 'b': {
                 int bid,meta;
                 if (sscanf(optarg, "%d:%d", &bid, &meta)==2) {
@@ -384,6 +396,316 @@ void extract_maps() {
     }
 }
 
+////////////////////////////////////////////////////////////////////////////////
+// block index
+
+// Statistics of the stored chunks, built in one pass over the block data:
+// the block IDs present in each 16x16x16 section, the height of each block
+// column and the number of blocks of each type. The index is kept in columns -
+// small per-chunk records, column heights, and presence bitmaps for the
+// non-empty sections only. With -I it is saved to a sidecar file and reused
+// while the input traces stay the same, so the searches it can answer alone
+// don't need to parse the traces at all
+
+#define BIDX_MAGIC      0x4d435849  // "MCXI"
+#define BIDX_VERSION    1
+#define BIDX_NDIM       3
+
+typedef struct {
+    int32_t     X, Z;
+    int8_t      dim;                // 0:overworld, 1:nether, 2:end
+    uint16_t    mask;               // sections containing non-air blocks
+    int32_t     sec;                // index of the chunk's first section bitmap
+} bidx_chunk;
+
+// highest non-air block in each column, -1 if none
+typedef struct {
+    int16_t     y[256];
+} bidx_top;
+
+// presence bitmap of the 4096 block IDs in a section
+typedef struct {
+    uint8_t     b[512];
+} bidx_bits;
+
+static struct {
+    uint64_t    count[BIDX_NDIM][65536];    // number of blocks by bid:meta
+    lh_arr_declare(bidx_chunk,ch);
+    lh_arr_declare(bidx_top,top);           // parallel to ch
+    lh_arr_declare(bidx_bits,bits);
+} bidx;
+
+static int bidx_dim(gsworld *w) {
+    if (w == &gs.nether) return 1;
+    if (w == &gs.end)    return 2;
+    return 0;
+}
+
+// check if section s of an indexed chunk may contain the block ID
+static inline int bidx_has(bidx_chunk *bc, int s, int bid) {
+    if (!(bc->mask&(1<<s))) return bid==0;
+    bidx_bits *bits = P(bidx.bits)+bc->sec+__builtin_popcount(bc->mask&((1<<s)-1));
+    return (bits->b[bid>>3]>>(bid&7))&1;
+}
+
+// number of blocks with the bid and meta (any meta if <0) in the dimension
+static uint64_t bidx_count(int dim, int bid, int meta) {
+    uint64_t sum = 0;
+    int m;
+    for(m=0; m<16; m++)
+        if (meta<0 || m==meta)
+            sum += bidx.count[dim][(bid<<4)|m];
+    return sum;
+}
+
+static void bidx_add_chunk(int dim, int32_t X, int32_t Z, gschunk *gc) {
+    bidx_chunk *bc = lh_arr_new(GAR(bidx.ch));
+    bc->X = X;
+    bc->Z = Z;
+    bc->dim = dim;
+    bc->mask = 0;
+    bc->sec = C(bidx.bits);
+
+    bidx_top *top = lh_arr_new(GAR(bidx.top));
+    memset(top->y, 0xff, sizeof(top->y));
+
+    uint64_t *count = bidx.count[dim];
+    int s,i;
+    for(s=0; s<16; s++) {
+        bid_t *bl = gc->blocks+(s<<12);
+        bidx_bits bits;
+        lh_clear_obj(bits);
+        int solid = 0;
+
+        for(i=0; i<4096; i++) {
+            bid_t b = bl[i];
+            count[b.raw]++;
+            bits.b[b.bid>>3] |= 1<<(b.bid&7);
+            if (b.bid) {
+                // blocks are ordered by height, so the last one wins
+                top->y[i&0xff] = (s<<4)|(i>>8);
+                solid = 1;
+            }
+        }
+
+        if (solid) {
+            bc->mask |= 1<<s;
+            *lh_arr_new(GAR(bidx.bits)) = bits;
+        }
+    }
+}
+
+// index all stored chunks of all dimensions
+static void bidx_build() {
+    gsworld *worlds[BIDX_NDIM] = { &gs.overworld, &gs.nether, &gs.end };
+
+    int d,s,r,c;
+    for(d=0; d<BIDX_NDIM; d++) {
+        gsworld *w = worlds[d];
+        for(s=0; s<512*512; s++) {
+            gssreg *sr = w->sreg[s];
+            if (!sr) continue;
+
+            for(r=0; r<256*256; r++) {
+                gsregion *re = sr->region[r];
+                if (!re) continue;
+
+                for(c=0; c<32*32; c++)
+                    if (re->chunk[c])
+                        bidx_add_chunk(d, CC_X(s,r,c), CC_Z(s,r,c), re->chunk[c]);
+            }
+        }
+    }
+}
+
+static void bidx_free() {
+    lh_arr_free(GAR(bidx.ch));
+    lh_arr_free(GAR(bidx.top));
+    lh_arr_free(GAR(bidx.bits));
+    lh_clear_obj(bidx.count);
+}
+
+static uint64_t fnv64(uint64_t h, const void *data, size_t len) {
+    const uint8_t *p = data;
+    while (len--) {
+        h ^= *p++;
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+// identify the input: trace file names, sizes and modification times,
+// and the options that affect which chunks are stored
+static uint64_t bidx_key(char **files) {
+    uint64_t h = fnv64(0xcbf29ce484222325ULL, "MCXI", 4);
+    int32_t opts[] = { BIDX_VERSION, o_reglimit, o_xmin, o_zmin, o_xmax, o_zmax };
+    h = fnv64(h, opts, sizeof(opts));
+
+    int i;
+    for(i=0; files[i]; i++) {
+        struct stat st;
+        int64_t attr[2] = { -1, -1 };
+        if (!stat(files[i], &st)) {
+            attr[0] = st.st_size;
+            attr[1] = st.st_mtime;
+        }
+        h = fnv64(h, files[i], strlen(files[i])+1);
+        h = fnv64(h, attr, sizeof(attr));
+    }
+    return h;
+}
+
+static void bidx_save(const char *path, uint64_t key) {
+    int d,i,n=0;
+    for(d=0; d<BIDX_NDIM; d++)
+        for(i=0; i<65536; i++)
+            if (bidx.count[d][i]) n++;
+
+    ssize_t len = 28 + n*11 + C(bidx.ch)*11 + C(bidx.top)*512 + C(bidx.bits)*512;
+    lh_create_buf(buf, len);
+    uint8_t *w = buf;
+
+    lh_write_int_be(w, BIDX_MAGIC);
+    lh_write_int_be(w, BIDX_VERSION);
+    lh_write_long_be(w, key);
+    lh_write_int_be(w, n);
+    lh_write_int_be(w, C(bidx.ch));
+    lh_write_int_be(w, C(bidx.bits));
+
+    // only the non-zero counts
+    for(d=0; d<BIDX_NDIM; d++) {
+        for(i=0; i<65536; i++) {
+            if (!bidx.count[d][i]) continue;
+            lh_write_char(w, d);
+            lh_write_short_be(w, i);
+            lh_write_long_be(w, bidx.count[d][i]);
+        }
+    }
+
+    for(i=0; i<C(bidx.ch); i++) {
+        bidx_chunk *bc = P(bidx.ch)+i;
+        lh_write_int_be(w, bc->X);
+        lh_write_int_be(w, bc->Z);
+        lh_write_char(w, bc->dim);
+        lh_write_short_be(w, bc->mask);
+    }
+
+    for(i=0; i<C(bidx.top)*256; i++)
+        lh_write_short_be(w, P(bidx.top)[i>>8].y[i&0xff]);
+
+    memmove(w, P(bidx.bits), C(bidx.bits)*512);
+    w += C(bidx.bits)*512;
+    assert(w-buf == len);
+
+    ssize_t clen;
+    uint8_t *cbuf = lh_gzip_encode(buf, len, &clen);
+    lh_free(buf);
+    if (!cbuf) {
+        printf("Failed to compress the block index\n");
+        return;
+    }
+
+    if (lh_save(path, cbuf, clen) == clen)
+        printf("Saved block index of %zd chunks to %s, %zd bytes\n", C(bidx.ch), path, clen);
+    else
+        printf("Failed to save block index to %s\n", path);
+    lh_free(cbuf);
+}
+
+// load the index if it exists and matches the key, returns nonzero on success
+static int bidx_load(const char *path, uint64_t key) {
+    uint8_t *cbuf;
+    ssize_t clen = lh_load_alloc(path, &cbuf);
+    if (clen < 0) return 0;
+
+    ssize_t len;
+    uint8_t *buf = lh_gzip_decode(cbuf, clen, &len);
+    lh_free(cbuf);
+    if (!buf) return 0;
+
+    uint8_t *p = buf;
+    int ok = 0;
+    if (len < 28) goto done;
+    if (lh_read_int_be(p) != BIDX_MAGIC) goto done;
+    if (lh_read_int_be(p) != BIDX_VERSION) goto done;
+    if ((uint64_t)lh_read_long_be(p) != key) {
+        printf("Block index %s is outdated, rebuilding\n", path);
+        goto done;
+    }
+    ssize_t n     = (uint32_t)lh_read_int_be(p);
+    ssize_t nch   = (uint32_t)lh_read_int_be(p);
+    ssize_t nbits = (uint32_t)lh_read_int_be(p);
+    if (len != 28 + n*11 + nch*(11+512) + nbits*512) goto done;
+
+    bidx_free();
+
+    int i;
+    for(i=0; i<n; i++) {
+        int d = lh_read_char(p);
+        int raw = (uint16_t)lh_read_short_be(p);
+        uint64_t cnt = lh_read_long_be(p);
+        if (d >= BIDX_NDIM) goto done;
+        bidx.count[d][raw] = cnt;
+    }
+
+    int32_t sec = 0;
+    for(i=0; i<nch; i++) {
+        bidx_chunk *bc = lh_arr_new(GAR(bidx.ch));
+        bc->X = lh_read_int_be(p);
+        bc->Z = lh_read_int_be(p);
+        bc->dim = lh_read_char(p);
+        bc->mask = lh_read_short_be(p);
+        bc->sec = sec;
+        sec += __builtin_popcount(bc->mask);
+        if (bc->dim >= BIDX_NDIM) goto done;
+    }
+    if (sec != nbits) goto done;
+
+    lh_arr_add(GAR4(bidx.top), nch);
+    for(i=0; i<nch*256; i++)
+        P(bidx.top)[i>>8].y[i&0xff] = lh_read_short_be(p);
+
+    lh_arr_add(GAR4(bidx.bits), nbits);
+    memmove(P(bidx.bits), p, nbits*512);
+
+    printf("Loaded block index of %zd chunks from %s\n", nch, path);
+    ok = 1;
+
+ done:
+    if (!ok) bidx_free();
+    lh_free(buf);
+    return ok;
+}
+
+// check if all requested operations can be served from the index alone
+static int bidx_sufficient() {
+    if (o_spawner_single || o_spawner_mult || o_track_inventory ||
+        o_track_thunder || o_dump_players || o_extract_maps || o_dump_packets ||
+        o_dump_entities || o_biomemap || o_worlddir || o_flatbedrock)
+        return 0;
+
+    // the positions of the found blocks are only in the chunk data
+    if (o_block_id >= 0 && bidx_count(bidx_dim(o_world), o_block_id, o_block_meta))
+        return 0;
+
+    return 1;
+}
+
+void dump_block_stats() {
+    int dim = bidx_dim(o_world);
+
+    int i;
+    for(i=0; i<65536; i++) {
+        uint64_t cnt = bidx.count[dim][i];
+        if (!cnt) continue;
+
+        bid_t b;
+        b.raw = i;
+        char buf[256] = "";
+        printf("Block %4d:%2d %-40s : %12ju\n", b.bid, b.meta, get_bid_name(buf, b), (uintmax_t)cnt);
+    }
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 
 void extract_biome_map() {
@@ -425,8 +747,19 @@ void extract_biome_map() {
 ////////////////////////////////////////////////////////////////////////////////
 
 void extract_height_map() {
-    int32_t Xmin,Xmax,Zmin,Zmax;
-    if (!get_stored_area(o_world, &Xmin, &Xmax, &Zmin, &Zmax)) {
+    int dim = bidx_dim(o_world);
+    int32_t Xmin=0,Xmax=0,Zmin=0,Zmax=0;
+    int i,set=0;
+    for(i=0; i<C(bidx.ch); i++) {
+        bidx_chunk *bc = P(bidx.ch)+i;
+        if (bc->dim != dim) continue;
+        if (!set || bc->X < Xmin) Xmin = bc->X;
+        if (!set || bc->X > Xmax) Xmax = bc->X;
+        if (!set || bc->Z < Zmin) Zmin = bc->Z;
+        if (!set || bc->Z > Zmax) Zmax = bc->Z;
+        set = 1;
+    }
+    if (!set) {
         printf("No chunks\n");
         return;
     }
@@ -434,25 +767,21 @@ void extract_height_map() {
     lhimage * img = allocate_image((Xmax-Xmin+1)*16, (Zmax-Zmin+1)*16, -1);
     assert(img);
 
-    int X,Z;
-    for(X=Xmin; X<=Xmax; X++) {
-        for(Z=Zmin; Z<=Zmax; Z++) {
-            gschunk *c = find_chunk(o_world, X, Z, 0);
-            if (!c) continue;
-
-            int x,z,h;
-            int xoff = (X-Xmin)*16, zoff = (Z-Zmin)*16;
+    // column heights are readily available in the index
+    for(i=0; i<C(bidx.ch); i++) {
+        bidx_chunk *bc = P(bidx.ch)+i;
+        if (bc->dim != dim) continue;
 
-            for(z=0; z<16; z++) {
-                for(x=0; x<16; x++) {
-                    for(h=255; h>=0; h--) {
-                        if (c->blocks[x+z*16+h*256].bid) {
-                            uint32_t color = (h<<16)|(h<<8)|h;
-                            IMGDOT(img, x+xoff, z+zoff) = color;
-                            break;
-                        }
-                    }
-                }
+        bidx_top *top = P(bidx.top)+i;
+        int x,z;
+        int xoff = (bc->X-Xmin)*16, zoff = (bc->Z-Zmin)*16;
+
+        for(z=0; z<16; z++) {
+            for(x=0; x<16; x++) {
+                int h = top->y[x+z*16];
+                if (h < 0) continue;
+                uint32_t color = (h<<16)|(h<<8)|h;
+                IMGDOT(img, x+xoff, z+zoff) = color;
             }
         }
     }
@@ -466,6 +795,65 @@ void extract_height_map() {
 
 ////////////////////////////////////////////////////////////////////////////////
 
+#define EX_MAXTHREADS 16
+
+typedef struct {
+    int         s, r;           // superregion and region index
+    gsregion   *re;
+    const char *dirname;
+    char        rpath[PATH_MAX];
+    int         nch;            // number of exported chunks
+} exreg;
+
+typedef struct {
+    exreg      *jobs;
+    int         njobs;
+    int         next;           // next region to pick up, taken atomically
+} exqueue;
+
+// build, compress and save a single region - regions are independent,
+// so any number of them can be exported at once
+static void export_region(exreg *job) {
+    int s=job->s, r=job->r, c;
+
+    int32_t RX = CC_X(s,r,0)>>5;
+    int32_t RZ = CC_Z(s,r,0)>>5;
+    //printf("s=%08x, r=%08x, RX=%08x, RZ=%08x\n",s,r,RX,RZ);
+
+    sprintf(job->rpath, "%s/r.%d.%d.mca", job->dirname, RX, RZ);
+
+    // check if the file exists and load it
+    // FIXME: right now we are just checking if the file can be loaded, catch other possible errors
+    mca * reg = NULL;
+    if (lh_path_isfile(job->rpath))
+        reg = anvil_load(job->rpath);
+    if (!reg) // if file does not exist or fails to load, create a new one
+        reg = anvil_create();
+
+    for(c=0; c<REGCHUNKS; c++) {
+        gschunk *ch = job->re->chunk[c];
+        if (!ch) continue;
+
+        int32_t X = CC_X(s,r,c);
+        int32_t Z = CC_Z(s,r,c);
+
+        anvil_insert_gschunk(reg, X, Z, ch);
+        job->nch++;
+    }
+
+    // existing region files only get the changed chunks rewritten
+    anvil_update(reg, job->rpath);
+    anvil_free(reg);
+}
+
+static void * export_worker(void *arg) {
+    exqueue *q = arg;
+    int i;
+    while ((i=__sync_fetch_and_add(&q->next, 1)) < q->njobs)
+        export_region(q->jobs+i);
+    return NULL;
+}
+
 int extract_world_data() {
     //TODO: delegate directory creation to libhelper
     // determine the directory to save files to
@@ -489,8 +877,10 @@ int extract_world_data() {
         return -1;
     }
 
-    // extract regions
-    int s,r,c,i;
+    // collect the regions to export - container tile entities are updated
+    // here, since they go through the shared gamestate
+    lh_arr_declare_i(exreg, jobs);
+    int s,r,c;
     for(s=0; s<512*512; s++) {
         gssreg *sr = o_world->sreg[s];
         if (!sr) continue;
@@ -499,40 +889,50 @@ int extract_world_data() {
             gsregion *re = sr->region[r];
             if (!re) continue;
 
-            int32_t RX = CC_X(s,r,0)>>5;
-            int32_t RZ = CC_Z(s,r,0)>>5;
-            //printf("s=%08x, r=%08x, RX=%08x, RZ=%08x\n",s,r,RX,RZ);
-
-            char rpath[PATH_MAX];
-            sprintf(rpath, "%s/r.%d.%d.mca", dirname, RX, RZ);
-
-            // check if the file exists and load it
-            // FIXME: right now we are just checking if the file can be loaded, catch other possible errors
-            mca * reg = NULL;
-            if (lh_path_isfile(rpath))
-                reg = anvil_load(rpath);
-            if (!reg) // if file does not exist or fails to load, create a new one
-                reg = anvil_create();
-
-            int nch = 0;
-            for(c=0; c<REGCHUNKS; c++) {
-                gschunk *ch = re->chunk[c];
-                if (!ch) continue;
-
-                int32_t X = CC_X(s,r,c);
-                int32_t Z = CC_Z(s,r,c);
-
-                update_chunk_containers(ch, X, Z);
-                nbt_t * nbtch = anvil_chunk_create(ch, X, Z);
-                anvil_insert_chunk(reg, X, Z, nbtch);
-                nch++;
-            }
+            exreg *job = lh_arr_new_c(GAR(jobs));
+            job->s = s;
+            job->r = r;
+            job->re = re;
+            job->dirname = dirname;
 
-            anvil_save(reg, rpath);
-            printf("Added %4d chunks to %s\n", nch, rpath);
+            for(c=0; c<REGCHUNKS; c++)
+                if (re->chunk[c])
+                    update_chunk_containers(re->chunk[c], CC_X(s,r,c), CC_Z(s,r,c));
         }
     }
 
+    // export the regions on a thread pool
+    int nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+    nthreads = MAX(1, MIN(nthreads, EX_MAXTHREADS));
+    nthreads = MIN(nthreads, C(jobs));
+
+    exqueue q = { P(jobs), C(jobs), 0 };
+    pthread_t threads[EX_MAXTHREADS];
+    int started[EX_MAXTHREADS];
+    int i;
+
+    uint64_t ts = gettimestamp();
+    for(i=1; i<nthreads; i++)
+        started[i] = !pthread_create(&threads[i], NULL, export_worker, &q);
+    export_worker(&q);
+    for(i=1; i<nthreads; i++)
+        if (started[i])
+            pthread_join(threads[i], NULL);
+    uint64_t te = gettimestamp();
+
+    // report in region order
+    int nch = 0;
+    for(i=0; i<C(jobs); i++) {
+        exreg *job = P(jobs)+i;
+        printf("Added %4d chunks to %s\n", job->nch, job->rpath);
+        nch += job->nch;
+    }
+
+    double sec = (te-ts)/1000000.0;
+    printf("Exported %d chunks in %zd regions on %d threads: %.2fs, %.0f chunks/s\n",
+           nch, C(jobs), nthreads, sec, sec>0 ? nch/sec : 0.0);
+
+    lh_arr_free(GAR(jobs));
     return 0;
 }
 
@@ -690,33 +1090,29 @@ void parse_mcp(uint8_t *data, ssize_t size, char * name) {
 
 void search_blocks(gsworld *w, int bid, int meta) {
     assert(w);
-
-    int s,r,c,i;
-    for(s=0; s<512*512; s++) {
-        gssreg *sr = w->sreg[s];
-        if (!sr) continue;
-
-        for(r=0; r<256*256; r++) {
-            gsregion *re = sr->region[r];
-            if (!re) continue;
-
-            for(c=0; c<32*32; c++) {
-                gschunk *ch = re->chunk[c];
-                if (!ch) continue;
-
-                int32_t X = CC_X(s,r,c);
-                int32_t Z = CC_Z(s,r,c);
-
-                for(i=0; i<65536; i++) {
-                    bid_t bl = ch->blocks[i];
-                    if (bl.bid == bid && (meta<0 || bl.meta == meta) ) {
-                        int32_t x = (X*16+(i&0xf));
-                        int32_t z = (Z*16+((i>>4)&0xf));
-                        int32_t y = i>>8;
-
-                        printf("Block %3d:%2d at %5d,%5d,%3d\n",
-                               bl.bid, bl.meta, x, z, y);
-                    }
+    int dim = bidx_dim(w);
+
+    // only scan the sections where the index has the block ID
+    int n,s,i;
+    for(n=0; n<C(bidx.ch); n++) {
+        bidx_chunk *bc = P(bidx.ch)+n;
+        if (bc->dim != dim) continue;
+
+        gschunk *ch = NULL;
+        for(s=0; s<16; s++) {
+            if (!bidx_has(bc, s, bid)) continue;
+            if (!ch) ch = find_chunk(w, bc->X, bc->Z, 0);
+            if (!ch) break;
+
+            for(i=s<<12; i<(s+1)<<12; i++) {
+                bid_t bl = ch->blocks[i];
+                if (bl.bid == bid && (meta<0 || bl.meta == meta) ) {
+                    int32_t x = (bc->X*16+(i&0xf));
+                    int32_t z = (bc->Z*16+((i>>4)&0xf));
+                    int32_t y = i>>8;
+
+                    printf("Block %3d:%2d at %5d,%5d,%3d\n",
+                           bl.bid, bl.meta, x, z, y);
                 }
             }
         }
@@ -728,60 +1124,51 @@ void search_blocks(gsworld *w, int bid, int meta) {
 void search_flat_bedrock() {
     gsworld * oldworld = gs.world;
     gs.world = &gs.nether;
-    gsworld *w = gs.world;
-
-    int s,r,c,i;
-    for(s=0; s<512*512; s++) {
-        gssreg *sr = w->sreg[s];
-        if (!sr) continue;
-
-        for(r=0; r<256*256; r++) {
-            gsregion *re = sr->region[r];
-            if (!re) continue;
-
-            for(c=0; c<32*32; c++) {
-                gschunk *ch = re->chunk[c];
-                if (!ch) continue;
-
-                int32_t X = CC_X(s,r,c);
-                int32_t Z = CC_Z(s,r,c);
-
-                int x,y,z;
-                for(y=123; y<125; y++) {
-                    for(x=0; x<16; x++) {
-                        for(z=0; z<16; z++) {
-                            int32_t xx = X*16+x;
-                            int32_t zz = Z*16+z;
-
-                            bid_t blk[] = {
-                                get_block_at(xx-1,zz-1,y),
-                                get_block_at(xx-1,zz,y),
-                                get_block_at(xx-1,zz+1,y),
-                                get_block_at(xx,zz-1,y),
-                                get_block_at(xx,zz,y),
-                                get_block_at(xx,zz+1,y),
-                                get_block_at(xx+1,zz-1,y),
-                                get_block_at(xx+1,zz,y),
-                                get_block_at(xx+1,zz+1,y),
-
-                                get_block_at(xx,zz,y-1),
-                                get_block_at(xx,zz,y-2),
-                            };
-
-                            if (blk[0].bid  == 7 &&
-                                blk[1].bid  == 7 &&
-                                blk[2].bid  == 7 &&
-                                blk[3].bid  == 7 &&
-                                blk[4].bid  == 7 &&
-                                blk[5].bid  == 7 &&
-                                blk[6].bid  == 7 &&
-                                blk[7].bid  == 7 &&
-                                blk[8].bid  == 7 &&
-                                blk[9].bid  != 7 &&
-                                blk[10].bid != 7)
-                                printf("Flat Bedrock at %d,%d y=%d\n",xx,zz,y);
-                        }
-                    }
+    int dim = bidx_dim(gs.world);
+
+    // skip chunks without any bedrock in the section at y=123..124
+    int n;
+    for(n=0; n<C(bidx.ch); n++) {
+        bidx_chunk *bc = P(bidx.ch)+n;
+        if (bc->dim != dim || !bidx_has(bc, 7, 7)) continue;
+
+        int32_t X = bc->X;
+        int32_t Z = bc->Z;
+
+        int x,y,z;
+        for(y=123; y<125; y++) {
+            for(x=0; x<16; x++) {
+                for(z=0; z<16; z++) {
+                    int32_t xx = X*16+x;
+                    int32_t zz = Z*16+z;
+
+                    bid_t blk[] = {
+                        get_block_at(xx-1,zz-1,y),
+                        get_block_at(xx-1,zz,y),
+                        get_block_at(xx-1,zz+1,y),
+                        get_block_at(xx,zz-1,y),
+                        get_block_at(xx,zz,y),
+                        get_block_at(xx,zz+1,y),
+                        get_block_at(xx+1,zz-1,y),
+                        get_block_at(xx+1,zz,y),
+                        get_block_at(xx+1,zz+1,y),
+
+                        get_block_at(xx,zz,y-1),
+                        get_block_at(xx,zz,y-2),
+                    };
+
+                    if (blk[0].bid  == 7 &&
+                        blk[1].bid  == 7 &&
+                        blk[2].bid  == 7 &&
+                        blk[3].bid  == 7 &&
+                        blk[4].bid  == 7 &&
+                        blk[5].bid  == 7 &&
+                        blk[6].bid  == 7 &&
+                        blk[7].bid  == 7 &&
+                        blk[8].bid  == 7 &&
+                        blk[9].bid  != 7 &&
+                        blk[10].bid != 7)
+                        printf("Flat Bedrock at %d,%d y=%d\n",xx,zz,y);
                 }
             }
         }
@@ -816,22 +1203,34 @@ int main(int ac, char **av) {
         gs_setopt(GSOP_ZMAX, o_zmax);
     }
 
-    int i;
-    for(i=optind; av[i]; i++) {
-        uint8_t *data;
-        ssize_t size = lh_load_alloc(av[i], &data);
-        if (size >= 0) {
-            parse_mcp(data, size, av[i]);
-            free(data);
-        }
-    }
-
     switch (o_dimension) {
         case 0:  o_world = &gs.overworld; break;
         case -1: o_world = &gs.nether; break;
         case 1:  o_world = &gs.end; break;
     }
 
+    // the traces need not be parsed if the index has all we need
+    uint64_t key = bidx_key(av+optind);
+    int indexed = o_index && bidx_load(o_index, key);
+
+    int i;
+    if (!indexed || !bidx_sufficient()) {
+        for(i=optind; av[i]; i++) {
+            uint8_t *data;
+            ssize_t size = lh_load_alloc(av[i], &data);
+            if (size >= 0) {
+                parse_mcp(data, size, av[i]);
+                free(data);
+            }
+        }
+    }
+
+    if (!indexed && (o_index || o_block_id>=0 || o_heightmap || o_flatbedrock || o_block_stats)) {
+        bidx_build();
+        if (o_index)
+            bidx_save(o_index, key);
+    }
+
     if (o_track_inventory)
         dump_inventory();
     //dump_entities();
@@ -850,6 +1249,9 @@ int main(int ac, char **av) {
     if (o_spawner_mult)
         find_spawners();
 
+    if (o_block_stats)
+        dump_block_stats();
+
     if (o_block_id >=0)
         search_blocks(o_world, o_block_id, o_block_meta);
 
@@ -871,6 +1273,7 @@ int main(int ac, char **av) {
     if (o_dump_entities)
         dump_entities();
 
+    bidx_free();
     gs_destroy();
 
     return 0;
@@ -14,6 +14,7 @@
 #include <string.h>
 
 #include <sys/socket.h>
+#include <sys/ioctl.h>
 #include <signal.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
@@ -27,11 +28,14 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <limits.h>
+#include <sys/uio.h>
+
+#include <zlib.h>
 
 #include <openssl/rsa.h>
 #include <openssl/x509.h>
 #include <openssl/sha.h>
-#include <openssl/aes.h>
+#include <openssl/evp.h>
 #include <openssl/err.h>
 #include <openssl/rand.h>
 #include <curl/curl.h>
@@ -53,6 +57,8 @@
 #include "mcp_gamestate.h"
 #include "mcp_game.h"
 #include "mcp_build.h"
+#include "mcp_archive.h"
+#include "aes.h"
 
 // forward declaration
 int query_auth_server();
@@ -61,6 +67,7 @@ int query_auth_server();
 #define DEFAULT_BIND_PORT   25565
 #define DEFAULT_REMOTE_ADDR "2b2t.org"
 #define DEFAULT_REMOTE_PORT 25565
+#define DEFAULT_ARCHIVE_MB  256
 
 const char * o_appname;
 int          o_help = 0;
@@ -70,6 +77,9 @@ char         o_raddr[256];
 uint16_t     o_rport;
 int          o_connactive = 0;
 char *       o_profile_path = NULL;
+int          o_zlevel = Z_BEST_SPEED;
+char *       o_archive = NULL;
+int          o_archive_mb = DEFAULT_ARCHIVE_MB;
 
 uint32_t     bind_ip;
 uint32_t     remote_ip;
@@ -93,6 +103,25 @@ void signal_handler(int signum) {
 
 lh_pollarray pa;
 
+// a slice of the outgoing data - either a range of the transmission buffer
+// or packet bytes in a receive buffer that are forwarded without copying
+typedef struct {
+    uint8_t *ptr;       // forwarded data, NULL if the slice is in the tx buffer
+    ssize_t  off;       // offset in the tx buffer
+    ssize_t  len;
+} txslice;
+
+typedef struct {
+    lh_arr_declare(txslice,sl);
+
+    // bytes sent and how many of them were copied on the way, either into
+    // the tx buffer, the encryption buffer or the connection's write buffer
+    ssize_t fwd, copied;
+} txslices;
+
+// print the copy counters when the session is closed
+#define DEBUG_TXCOPY 0
+
 struct {
     int state;          // handshake state
 
@@ -109,6 +138,10 @@ struct {
     lh_buf_t  ms_rx;   // server -> proxy
     lh_buf_t  ms_tx;   // proxy -> client
 
+    // outgoing data in transmission order, see write_packet_raw
+    txslices  cs_txs;  // proxy -> server
+    txslices  ms_txs;  // proxy -> client
+
     // RSA structures/keys for server-side and client-side
     RSA *s_rsa; // public key only - must be freed by RSA_free
     RSA *c_rsa; // public+private key - must be freed by RSA_free
@@ -140,13 +173,11 @@ struct {
     int encstate;
     int passfirst;
 
-    AES_KEY c_aes;
-    uint8_t c_enc_iv[16];
-    uint8_t c_dec_iv[16];
+    aes_stream c_enc;
+    aes_stream c_dec;
 
-    AES_KEY s_aes;
-    uint8_t s_enc_iv[16];
-    uint8_t s_dec_iv[16];
+    aes_stream s_enc;
+    aes_stream s_dec;
 
     int enable_encryption;
     int encryption_active;
@@ -163,18 +194,136 @@ uint16_t remote_port;
 
 ////////////////////////////////////////////////////////////////////////////////
 
+#define TXSLICES(buf) (((buf)==&mitm.cs_tx) ? &mitm.cs_txs : &mitm.ms_txs)
+
+// returns true if the data lies in one of the receive buffers, i.e. it will
+// stay in place until the transmission buffers are flushed
+static int in_rx(uint8_t *ptr, ssize_t len) {
+    lh_buf_t *rx[2] = { &mitm.cs_rx, &mitm.ms_rx };
+    int i;
+    for(i=0; i<2; i++)
+        if (P(rx[i]->data) && ptr >= P(rx[i]->data) && ptr+len <= P(rx[i]->data)+C(rx[i]->data))
+            return 1;
+    return 0;
+}
+
+static void add_slice(txslices *ts, uint8_t *ptr, ssize_t off, ssize_t len) {
+    txslice *last = C(ts->sl) ? P(ts->sl)+C(ts->sl)-1 : NULL;
+    if (last && !ptr && !last->ptr && last->off+last->len == off) {
+        last->len += len;
+        return;
+    }
+    txslice *sl = lh_arr_new(GAR(ts->sl));
+    sl->ptr = ptr;
+    sl->off = off;
+    sl->len = len;
+}
+
+// append a packet to the transmission buffer, prefixed with its length.
+// Packets still sitting in the receive buffer are not copied, only referenced
 void write_packet_raw(uint8_t *ptr, ssize_t len, lh_buf_t *buf) {
     uint8_t hbuf[16]; CLEAR(hbuf);
     ssize_t ll = lh_place_varint(hbuf,len) - hbuf;
 
+    txslices *ts = TXSLICES(buf);
     ssize_t widx = buf->C(data);
 
+    if (in_rx(ptr, len)) {
+        lh_arr_add(GAR4(buf->data),ll);
+        memmove(P(buf->data)+widx, hbuf, ll);
+        add_slice(ts, NULL, widx, ll);
+        add_slice(ts, ptr, 0, len);
+        ts->copied += ll;
+        return;
+    }
+
     lh_arr_add(GAR4(buf->data),(len+ll));
 
     memmove(P(buf->data)+widx, hbuf, ll);
     memmove(P(buf->data)+widx+ll, ptr, len);
+    add_slice(ts, NULL, widx, len+ll);
+    ts->copied += len+ll;
 }
 
+// write the data to the socket directly if the connection has nothing queued,
+// whatever could not be sent is copied into the connection's write buffer.
+// niov must not exceed UIO_MAXIOV. Returns the number of bytes copied
+static ssize_t tx_send(lh_conn *conn, int fd, struct iovec *iov, int niov) {
+    ssize_t sent = 0, copied = 0;
+    if (conn->wbuf.C(data) == conn->wbuf.ridx) {
+        struct msghdr msg; CLEAR(msg);
+        msg.msg_iov = iov;
+        msg.msg_iovlen = niov;
+        sent = sendmsg(fd, &msg, MSG_NOSIGNAL);
+        if (sent < 0) sent = 0; // let lh_conn deal with EAGAIN and errors
+    }
+
+    int i;
+    for(i=0; i<niov; i++) {
+        if (sent >= iov[i].iov_len) {
+            sent -= iov[i].iov_len;
+            continue;
+        }
+        lh_conn_write(conn, (uint8_t *)iov[i].iov_base+sent, iov[i].iov_len-sent);
+        copied += iov[i].iov_len-sent;
+        sent = 0;
+    }
+    return copied;
+}
+
+// encrypt if needed and send off everything queued in the transmission buffer
+static void tx_flush(lh_buf_t *tx) {
+    txslices *ts = TXSLICES(tx);
+    if (!C(ts->sl)) return;
+
+    int to_server = (tx == &mitm.cs_tx);
+    lh_conn *conn = to_server ? mitm.ms_conn : mitm.cs_conn;
+    int fd        = to_server ? mitm.ms : mitm.cs;
+
+    if (mitm.encryption_active) {
+        // encrypt all slices into a single buffer, in order
+        static lh_buf_t enc;
+        enc.C(data) = 0;
+        lh_arr_add(GAR4(enc.data), tx->C(data));
+
+        ssize_t eidx = 0;
+        int i;
+        for(i=0; i<C(ts->sl); i++) {
+            txslice *sl = P(ts->sl)+i;
+            uint8_t *src = sl->ptr ? sl->ptr : P(tx->data)+sl->off;
+            if (sl->ptr) lh_arr_add(GAR4(enc.data), sl->len);
+
+            aes_encrypt(to_server ? &mitm.s_enc : &mitm.c_enc, src, P(enc.data)+eidx, sl->len);
+            eidx += sl->len;
+        }
+
+        struct iovec iov = { P(enc.data), eidx };
+        ts->copied += eidx + tx_send(conn, fd, &iov, 1);
+        ts->fwd += eidx;
+    }
+    else {
+        // send the slices in batches of at most UIO_MAXIOV - once a batch
+        // is not sent completely, the rest goes to the write buffer in order
+        struct iovec iov[UIO_MAXIOV];
+        int i, n = 0;
+        for(i=0; i<C(ts->sl); i++) {
+            txslice *sl = P(ts->sl)+i;
+            iov[n].iov_base = sl->ptr ? sl->ptr : P(tx->data)+sl->off;
+            iov[n].iov_len  = sl->len;
+            ts->fwd += sl->len;
+            if (++n == UIO_MAXIOV || i == C(ts->sl)-1) {
+                ts->copied += tx_send(conn, fd, iov, n);
+                n = 0;
+            }
+        }
+    }
+
+    tx->C(data) = tx->ridx = 0;
+    C(ts->sl) = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
 void process_encryption_request(uint8_t *p, lh_buf_t *forw) {
     SL_EncryptionRequest_pkt pkt;
     decode_encryption_request(&pkt, p);
@@ -403,7 +552,72 @@ uint8_t cbuf[MCP_MAXPLEN];
 #define LIM64(len) ((len)>64?64:(len))
 #define LIM128(len) ((len)>128?128:(len))
 
+// the packet currently being processed and its original frame in the receive
+// buffer - if it gets forwarded unmodified, the frame is sent instead of
+// encoding and compressing it again
+static MCPacket * fwd_pkt = NULL;
+static lh_buf_t * fwd_tx  = NULL;
+static uint8_t  * fwd_frame;
+static ssize_t    fwd_len;
+
+// compress a packet with the configured compression level
+static ssize_t zlib_encode(uint8_t *src, ssize_t len, uint8_t *dst, ssize_t dlen) {
+    static z_stream zs;
+    static int zinit = 0;
+
+    if (!zinit) {
+        if (deflateInit(&zs, o_zlevel) != Z_OK) return -1;
+        zinit = 1;
+    }
+    else {
+        deflateReset(&zs);
+    }
+
+    zs.next_in   = src;
+    zs.avail_in  = len;
+    zs.next_out  = dst;
+    zs.avail_out = dlen;
+    if (deflate(&zs, Z_FINISH) != Z_STREAM_END) return -1;
+
+    return dlen-zs.avail_out;
+}
+
+// inflate only the first few bytes of a compressed packet to get its type
+static int32_t zlib_peek_type(uint8_t *src, ssize_t len) {
+    static z_stream zs;
+    static int zinit = 0;
+
+    if (!zinit) {
+        if (inflateInit(&zs) != Z_OK) return -1;
+        zinit = 1;
+    }
+    else {
+        inflateReset(&zs);
+    }
+
+    uint8_t buf[5];
+    zs.next_in   = src;
+    zs.avail_in  = len;
+    zs.next_out  = buf;
+    zs.avail_out = sizeof(buf);
+    int rc = inflate(&zs, Z_SYNC_FLUSH);
+    if (rc != Z_OK && rc != Z_STREAM_END && rc != Z_BUF_ERROR) return -1;
+
+    int i, n = sizeof(buf)-zs.avail_out;
+    int32_t type = 0;
+    for(i=0; i<n; i++) {
+        type |= (buf[i]&0x7f)<<(7*i);
+        if (!(buf[i]&0x80)) return type;
+    }
+    return -1;
+}
+
 void write_packet(MCPacket *pkt, lh_buf_t *tx) {
+    if (pkt == fwd_pkt && tx == fwd_tx && pkt->raw && !pkt->modified) {
+        write_packet_raw(fwd_frame, fwd_len, tx);
+        return;
+    }
+
     ssize_t ulen = encode_packet(pkt, ubuf);
 
     if (mitm.comptr >= 0) {
@@ -413,7 +627,7 @@ void write_packet(MCPacket *pkt, lh_buf_t *tx) {
         if (ulen >= mitm.comptr) {
             // length is at or over threshold - compress it
             write_varint(w, (int32_t)ulen);
-            clen = lh_zlib_encode_to(ubuf, ulen, w, cbuf+sizeof(cbuf)-w);
+            clen = zlib_encode(ubuf, ulen, w, cbuf+sizeof(cbuf)-w);
             assert(clen > 0);
         }
         else {
@@ -475,6 +689,14 @@ void process_play_packet(int is_client, struct timeval ts,
         int32_t usize = lh_read_varint(p); // supposed size of uncompressed data
 
         if (usize>0) {
+            // if nobody is interested in this packet, don't even uncompress
+            // it and forward the original frame
+            int32_t rawtype = zlib_peek_type(p, plim-p);
+            if (rawtype >= 0 && !packet_inspected(is_client, rawtype)) {
+                write_packet_raw(raw_ptr, raw_len, tx);
+                return;
+            }
+
             // packet is compressed - uncompress into temp buffer
             comp = '*';
             plen = lh_zlib_decode_to(p,plen,ubuf,usize);
@@ -518,11 +740,16 @@ void process_play_packet(int is_client, struct timeval ts,
 
     // pass the packet to both gamestate and game
     gs_packet(pkt);
+    fwd_pkt   = pkt;
+    fwd_tx    = tx;
+    fwd_frame = raw_ptr;
+    fwd_len   = raw_len;
     gm_packet(pkt, &tq, &bq);
 
     // transmit packets in the queues, if any
     flush_queue(&tq, tx);
     flush_queue(&bq, bx);
+    fwd_pkt = NULL;
 }
 
 
@@ -530,6 +757,11 @@ void process_play_packet(int is_client, struct timeval ts,
 
 // stop current game session, close and cleanup everything
 void close_session() {
+    if (DEBUG_TXCOPY) {
+        printf("client->server: %zd bytes sent, %zd copied\n", mitm.cs_txs.fwd, mitm.cs_txs.copied);
+        printf("server->client: %zd bytes sent, %zd copied\n", mitm.ms_txs.fwd, mitm.ms_txs.copied);
+    }
+
     // flush MCP saved file
     if (mitm.output) {
         fflush(mitm.output);
@@ -547,11 +779,19 @@ void close_session() {
     if (mitm.s_rsa) RSA_free(mitm.s_rsa);
     if (mitm.c_rsa) RSA_free(mitm.c_rsa);
 
+    // Cleanup cipher contexts
+    aes_stream_free(&mitm.c_enc);
+    aes_stream_free(&mitm.c_dec);
+    aes_stream_free(&mitm.s_enc);
+    aes_stream_free(&mitm.s_dec);
+
     // Cleanup connection buffers
     lh_free(P(mitm.cs_rx.data));
     lh_free(P(mitm.cs_tx.data));
     lh_free(P(mitm.ms_rx.data));
     lh_free(P(mitm.ms_tx.data));
+    lh_free(P(mitm.cs_txs.sl));
+    lh_free(P(mitm.ms_txs.sl));
 
     // Remove pollarray handlers
     if (mitm.cs_conn) lh_conn_remove(mitm.cs_conn);
@@ -604,13 +844,7 @@ ssize_t handle_proxy(lh_conn *conn) {
 
     if (mitm.encryption_active) {
         // the connection is already authenticated, decrypt data
-        int num = 0;
-        if (is_client)
-            AES_cfb8_encrypt(sptr, rx->P(data)+widx, slen,
-                             &mitm.c_aes, mitm.c_dec_iv, &num, AES_DECRYPT);
-        else
-            AES_cfb8_encrypt(sptr, rx->P(data)+widx, slen,
-                             &mitm.s_aes, mitm.s_dec_iv, &num, AES_DECRYPT);
+        aes_decrypt(is_client ? &mitm.c_dec : &mitm.s_dec, sptr, rx->P(data)+widx, slen);
     }
     else {
         // the authentication phase is not over yet - plaintext data
@@ -630,17 +864,20 @@ ssize_t handle_proxy(lh_conn *conn) {
     //assert(bx->C(data)==0);
 
     // try to extract as many packets from the stream as we can in a loop
-    while(rx->C(data) > 0) {
-        //hexdump(AR(rx->data));
+    // ridx - start of the next packet, the processed data is removed only
+    // after the loop since the forwarded packets may still refer to it
+    ssize_t ridx = 0;
+    while(rx->C(data) > ridx) {
         // do we have a complete packet?
-        uint8_t *p = rx->P(data);
+        uint8_t *p = rx->P(data)+ridx;
+        ssize_t avail = rx->C(data)-ridx;
 
         // large varint, data is definitely too short
-        if (((*p)&0x80)&&(rx->C(data)<129)) break;
+        if (((*p)&0x80)&&(avail<129)) break;
 
         uint32_t plen = lh_read_varint(p);
-        ssize_t ll = p-rx->P(data); // length of the varint
-        if (plen+ll > rx->C(data)) break; // packet is incomplete
+        ssize_t ll = p-(rx->P(data)+ridx); // length of the varint
+        if (plen+ll > avail) break; // packet is incomplete
 
         struct timeval tv;
         gettimeofday(&tv, NULL);
@@ -669,45 +906,16 @@ ssize_t handle_proxy(lh_conn *conn) {
             // handle IDLE, STATUS and LOGIN packets here
             process_packet(is_client, p, plen, tx, bx);
         }
-        // remove processed packet from the buffer
-        lh_arr_delete_range(GAR4(rx->data),0,ll+plen);
+        ridx += ll+plen;
     }
 
-    // if there's data in the transmission buffer, encrypt it if needed and send off
-    if (tx->C(data) > 0) {
-        if (mitm.encryption_active) {
-            // since we always write out all data, we just encrypt this in-place
-            int num=0;
-            if (is_client)
-                AES_cfb8_encrypt(tx->P(data), tx->P(data), tx->C(data),
-                                 &mitm.s_aes, mitm.s_enc_iv, &num, AES_ENCRYPT);
-            else
-                AES_cfb8_encrypt(tx->P(data), tx->P(data), tx->C(data),
-                                 &mitm.c_aes, mitm.c_enc_iv, &num, AES_ENCRYPT);
-        }
-
-        // send everything
-        lh_conn_write(is_client?mitm.ms_conn:mitm.cs_conn, AR(tx->data));
-        tx->C(data) = tx->ridx = 0;
-    }
+    // encrypt if needed and send off the forwarded data and the responses
+    tx_flush(tx);
+    tx_flush(bx);
 
-    // if there's data in the response buffer, encrypt it if needed and send off
-    if (bx->C(data) > 0) {
-        if (mitm.encryption_active) {
-            // since we always write out all data, we just encrypt this in-place
-            int num=0;
-            if (is_client)
-                AES_cfb8_encrypt(bx->P(data), bx->P(data), bx->C(data),
-                                 &mitm.c_aes, mitm.c_enc_iv, &num, AES_ENCRYPT);
-            else
-                AES_cfb8_encrypt(bx->P(data), bx->P(data), bx->C(data),
-                                 &mitm.s_aes, mitm.s_enc_iv, &num, AES_ENCRYPT);
-        }
-
-        // send everything
-        lh_conn_write(is_client?mitm.cs_conn:mitm.ms_conn, AR(bx->data));
-        bx->C(data) = bx->ridx = 0;
-    }
+    // remove processed packets from the buffer
+    if (ridx > 0)
+        lh_arr_delete_range(GAR4(rx->data),0,ridx);
 
     if (mitm.disconnect_required) {
         close_session();
@@ -717,21 +925,15 @@ ssize_t handle_proxy(lh_conn *conn) {
     if (mitm.enable_encryption) {
         // Set up the encryption. This is delayed so the last auth phase packet
         // CL_EncryptionResponse can go out unencrypted
-        AES_set_encrypt_key(mitm.c_skey, 128, &mitm.c_aes);
-        memcpy(mitm.c_enc_iv, mitm.c_skey, 16);
-        memcpy(mitm.c_dec_iv, mitm.c_skey, 16);
+        aes_stream_init(&mitm.c_enc, mitm.c_skey, 0);
+        aes_stream_init(&mitm.c_dec, mitm.c_skey, 1);
 
-        AES_set_encrypt_key(mitm.s_skey, 128, &mitm.s_aes);
-        memcpy(mitm.s_enc_iv, mitm.s_skey, 16);
-        memcpy(mitm.s_dec_iv, mitm.s_skey, 16);
+        aes_stream_init(&mitm.s_enc, mitm.s_skey, 0);
+        aes_stream_init(&mitm.s_dec, mitm.s_skey, 1);
 
 #if 0
         printf("c_skey:   "); hexdump(mitm.c_skey,16);
-        printf("c_enc_iv: "); hexdump(mitm.c_enc_iv,16);
-        printf("c_dec_iv: "); hexdump(mitm.c_dec_iv,16);
         printf("s_skey:   "); hexdump(mitm.s_skey,16);
-        printf("s_enc_iv: "); hexdump(mitm.s_enc_iv,16);
-        printf("s_dec_iv: "); hexdump(mitm.s_dec_iv,16);
 #endif
 
         mitm.enable_encryption=0;
@@ -748,6 +950,22 @@ void drop_connection() {
     close(mitm.cs);
 }
 
+// number of bytes we have queued for the client that it did not receive yet:
+// unsent data in our buffers plus the socket's send queue, -1 if unknown
+ssize_t client_backlog() {
+    if (mitm.cs<0 || !mitm.cs_conn) return -1;
+
+#ifdef TIOCOUTQ
+    int outq = 0;
+    if (ioctl(mitm.cs, TIOCOUTQ, &outq) < 0) return -1;
+
+    lh_buf_t *wb = &mitm.cs_conn->wbuf;
+    return outq + (wb->C(data)-wb->ridx) + mitm.ms_tx.C(data);
+#else
+    return -1;
+#endif
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 // Session Server
 
@@ -1098,7 +1316,8 @@ int proxy_pump() {
 
     // main event loop
     while(!signal_caught) {
-        lh_poll(&pa, 1000); // poll all sockets
+        // poll all sockets, wake up in time for the next async task
+        lh_poll(&pa, (mitm.state == STATE_PLAY) ? gm_timeout() : 1000);
 
         lh_polldata *pd;
 
@@ -1117,10 +1336,14 @@ int proxy_pump() {
             flush_queue(&sq, &mitm.cs_tx);
             flush_queue(&cq, &mitm.ms_tx);
         }
+
+        // evict chunks paged in from the archive over the budget
+        archive_trim();
     }
 
     printf("Terminating...\n");
 
+    archive_close();
     gs_destroy();
     gm_reset();
 
@@ -1139,8 +1362,11 @@ void print_usage() {
            "  -b [bindaddr:]bindport  : address and port to bind the proxy socket to. Default: %s:%d\n"
            "  -c                      : allow connections while session is active\n"
            "  -p profile_path         : location of Minecraft profile, default is %%APPDATA%%/.minecraft/launcher_profile.json\n"
+           "  -z level                : zlib compression level for packets modified or created by the proxy, 1..9. Default: %d\n"
+           "  -a worlddir             : page chunks missing in the gamestate in from the Anvil world at worlddir\n"
+           "  -m MB                   : memory budget for the chunks paged in with -a. Default: %d\n"
            "  [server[:port]]         : remote Minecraft server address and port. Default: %s:%d\n",
-           o_appname, DEFAULT_BIND_ADDR, DEFAULT_BIND_PORT, DEFAULT_REMOTE_ADDR, DEFAULT_REMOTE_PORT);
+           o_appname, DEFAULT_BIND_ADDR, DEFAULT_BIND_PORT, Z_BEST_SPEED, DEFAULT_ARCHIVE_MB, DEFAULT_REMOTE_ADDR, DEFAULT_REMOTE_PORT);
 }
 
 int parse_args(int ac, char **av) {
@@ -1157,7 +1383,7 @@ int parse_args(int ac, char **av) {
     char addr[256];
     int port,nchars;
 
-    while ( (opt=getopt(ac,av,"b:hcp:")) != -1 ) {
+    while ( (opt=getopt(ac,av,"a:b:hcm:p:z:")) != -1 ) {
         switch (opt) {
             case 'h':
                 o_help = 1;
@@ -1185,6 +1411,23 @@ int parse_args(int ac, char **av) {
             case 'p':
                 o_profile_path = strdup(optarg);
                 break;
+            case 'z':
+                o_zlevel = atoi(optarg);
+                if (o_zlevel < 1 || o_zlevel > 9) {
+                    printf("Compression level must be in range 1..9\n");
+                    error++;
+                }
+                break;
+            case 'a':
+                o_archive = strdup(optarg);
+                break;
+            case 'm':
+                o_archive_mb = atoi(optarg);
+                if (o_archive_mb < 1) {
+                    printf("Archive memory budget must be at least 1 MB\n");
+                    error++;
+                }
+                break;
             case '?': {
                 printf("Unknown option -%c", opt);
                 error++;
@@ -1327,6 +1570,9 @@ int main(int ac, char **av) {
 
     curl_global_init(CURL_GLOBAL_DEFAULT);
 
+    if (o_archive)
+        archive_open(o_archive, o_archive_mb);
+
     // start monitoring connection events
     proxy_pump();
 
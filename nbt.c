@@ -11,6 +11,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdarg.h>
+#include <zlib.h>
 
 #include <lh_debug.h>
 #include <lh_buffers.h>
@@ -200,86 +201,758 @@ nbt_t * nbt_parse(uint8_t **p) {
     return nbt_parse_type(p, type, 1);
 }
 
-// serialize NBT object to a buffer
-//FIXME: this function assumes the output buffer has sufficient size
-//(typically, it will be the MAXPLEN (4MiB) buffer in mcproxy used for packet encoding)
-void nbt_write(uint8_t **w, nbt_t *nbt) {
+////////////////////////////////////////////////////////////////////////////////
+// name index
+
+// compounds with at least this many elements are given a hash index
+// of the element names, so nbt_hget does not need to scan them
+#define NBT_HASH_MIN 8
+
+typedef struct {
+    uint32_t hash;
+    int32_t  idx;       // element index, -1 for empty slots
+} nbt_slot;
+
+typedef struct nbt_index {
+    uint32_t mask;
+    nbt_slot slot[];
+} nbt_index;
+
+static inline uint32_t nbt_name_hash(const char *s) {
+    uint32_t h = 2166136261u;
+    while (*s) {
+        h ^= (uint8_t)*s++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+// number of slots for a compound - keep the load factor at or below 1/2
+static inline uint32_t nbt_index_slots(ssize_t count) {
+    uint32_t n = 16;
+    while (n < count*2) n <<= 1;
+    return n;
+}
+
+static inline ssize_t nbt_index_size(uint32_t nslots) {
+    return sizeof(nbt_index) + nslots*sizeof(nbt_slot);
+}
+
+// linear probing keeps the earlier of duplicate names first in the chain,
+// so lookups return the same element as a scan would
+static void nbt_index_insert(nbt_index *idx, nbt_t *el, int32_t i) {
+    if (!el->name) return;
+
+    uint32_t h = nbt_name_hash(el->name), s;
+    for(s=h&idx->mask; idx->slot[s].idx>=0; s=(s+1)&idx->mask);
+    idx->slot[s].hash = h;
+    idx->slot[s].idx  = i;
+}
+
+// fill the index in idx with the elements of a compound and attach it
+static void nbt_index_build(nbt_t *nbt, nbt_index *idx) {
+    idx->mask = nbt_index_slots(nbt->count)-1;
+    memset(idx->slot, 0xff, (idx->mask+1)*sizeof(nbt_slot));
+
+    int32_t i;
+    for(i=0; i<nbt->count; i++)
+        nbt_index_insert(idx, nbt->co[i], i);
+    nbt->hidx = idx;
+}
+
+static nbt_t * nbt_index_get(nbt_t *nbt, const char *name) {
+    nbt_index *idx = nbt->hidx;
+    uint32_t h = nbt_name_hash(name), s;
+
+    for(s=h&idx->mask; idx->slot[s].idx>=0; s=(s+1)&idx->mask) {
+        if (idx->slot[s].hash != h) continue;
+        nbt_t *el = nbt->co[idx->slot[s].idx];
+        if (!strcmp(el->name, name)) return el;
+    }
+    return NULL;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// arena parsing
+
+// The tree is parsed in two passes - the first one only scans the data to
+// compute the exact size of the arena and the element counts of compounds,
+// the second one parses the data into the arena. The root node is placed at
+// the start of the arena, so freeing it releases the whole tree
+
+#define NBT_ALIGN(n) (((n)+7)&~(ssize_t)7)
+
+typedef struct {
+    int      flags;
+    uint8_t *mem;
+    ssize_t  used;
+    lh_arr_declare(int32_t,cnt);    // element counts of compounds, in parse order
+    ssize_t  ci;                    // next compound count to use
+} nbt_arena;
+
+static void * arena_alloc(nbt_arena *a, ssize_t size) {
+    void *ptr = a->mem+a->used;
+    a->used += NBT_ALIGN(size);
+    return ptr;
+}
+
+static ssize_t nbt_measure(uint8_t **p, uint8_t type, int named, nbt_arena *a) {
+    ssize_t size = NBT_ALIGN(sizeof(nbt_t));
+    int32_t i, n;
+
+    if (named) {
+        n = (uint16_t)lh_read_short_be(*p);
+        *p += n;
+        size += NBT_ALIGN(n+1);
+    }
+
+    switch (type) {
+        case NBT_BYTE:      *p += 1; break;
+        case NBT_SHORT:     *p += 2; break;
+        case NBT_INT:
+        case NBT_FLOAT:     *p += 4; break;
+        case NBT_LONG:
+        case NBT_DOUBLE:    *p += 8; break;
+
+        case NBT_BYTE_ARRAY:
+            n = lh_read_int_be(*p);
+            *p += n;
+            if ((a->flags&NBT_VIEW) != NBT_VIEW) size += NBT_ALIGN(n);
+            break;
+
+        case NBT_INT_ARRAY:
+            n = lh_read_int_be(*p);
+            *p += n*4;
+            size += NBT_ALIGN(n*4);
+            break;
+
+        case NBT_STRING:
+            n = (uint16_t)lh_read_short_be(*p);
+            *p += n;
+            size += NBT_ALIGN(n+1);
+            break;
+
+        case NBT_LIST: {
+            uint8_t ltype = lh_read_char(*p);
+            n = lh_read_int_be(*p);
+            if (n > 0) size += NBT_ALIGN(n*sizeof(nbt_t *));
+            for(i=0; i<n; i++)
+                size += nbt_measure(p, ltype, 0, a);
+            break;
+        }
+
+        case NBT_COMPOUND: {
+            ssize_t ci = C(a->cnt);
+            *lh_arr_new(GAR(a->cnt)) = 0;
+            uint8_t ctype;
+            n = 0;
+            while( (ctype=lh_read_char(*p)) ) {
+                size += nbt_measure(p, ctype, 1, a);
+                n++;
+            }
+            P(a->cnt)[ci] = n;
+            size += NBT_ALIGN(n*sizeof(nbt_t *));
+            if (n >= NBT_HASH_MIN)
+                size += NBT_ALIGN(nbt_index_size(nbt_index_slots(n)));
+            break;
+        }
+    }
+
+    return size;
+}
+
+static nbt_t * nbt_parse_arena(uint8_t **p, uint8_t type, int named, nbt_arena *a) {
+    int i;
+
+    nbt_t *nbt = arena_alloc(a, sizeof(nbt_t));
+    lh_clear_obj(*nbt);
+    nbt->type = type;
+    nbt->arena = NBT_ARENA_NODE;
+    nbt->count = 1;
+
+    if (named) {
+        uint16_t slen = lh_read_short_be(*p);
+        nbt->name = arena_alloc(a, slen+1);
+        memmove(nbt->name, *p, slen);
+        nbt->name[slen] = 0;
+        *p += slen;
+    }
+
+    switch (type) {
+        case NBT_BYTE:
+            nbt->b = lh_read_char(*p);
+            break;
+
+        case NBT_SHORT:
+            nbt->s = lh_read_short_be(*p);
+            break;
+
+        case NBT_INT:
+            nbt->i = lh_read_int_be(*p);
+            break;
+
+        case NBT_LONG:
+            nbt->l = lh_read_long_be(*p);
+            break;
+
+        case NBT_FLOAT:
+            nbt->f = lh_read_float_be(*p);
+            break;
+
+        case NBT_DOUBLE:
+            nbt->d = lh_read_double_be(*p);
+            break;
+
+        case NBT_BYTE_ARRAY:
+            nbt->count = lh_read_int_be(*p);
+            if ((a->flags&NBT_VIEW) == NBT_VIEW) {
+                nbt->ba = (int8_t *)*p;
+            }
+            else {
+                nbt->ba = arena_alloc(a, nbt->count);
+                memmove(nbt->ba, *p, nbt->count);
+            }
+            *p += nbt->count;
+            break;
+
+        case NBT_INT_ARRAY:
+            nbt->count = lh_read_int_be(*p);
+            nbt->ia = arena_alloc(a, nbt->count*4);
+            for(i=0; i<nbt->count; i++)
+                nbt->ia[i] = lh_read_int_be(*p);
+            break;
+
+        case NBT_STRING:
+            nbt->count = (uint16_t)lh_read_short_be(*p);
+            nbt->st = arena_alloc(a, nbt->count+1);
+            memmove(nbt->st, *p, nbt->count);
+            nbt->st[nbt->count] = 0;
+            *p += nbt->count;
+            break;
+
+        case NBT_LIST: {
+            nbt->ltype = lh_read_char(*p);
+            nbt->count = lh_read_int_be(*p);
+            if (nbt->count > 0)
+                nbt->li = arena_alloc(a, nbt->count*sizeof(nbt_t *));
+
+            for(i=0; i<nbt->count; i++)
+                nbt->li[i] = nbt_parse_arena(p, nbt->ltype, 0, a);
+
+            break;
+        }
+
+        case NBT_COMPOUND: {
+            nbt->count = P(a->cnt)[a->ci++];
+            nbt->co = arena_alloc(a, nbt->count*sizeof(nbt_t *));
+
+            uint8_t ctype;
+            i = 0;
+            while( (ctype=lh_read_char(*p)) )
+                nbt->co[i++] = nbt_parse_arena(p, ctype, 1, a);
+
+            // arena compounds get their index up front, since it can't be
+            // allocated separately later
+            if (nbt->count >= NBT_HASH_MIN)
+                nbt_index_build(nbt, arena_alloc(a,
+                    nbt_index_size(nbt_index_slots(nbt->count))));
+            break;
+        }
+    }
+
+    return nbt;
+}
+
+static nbt_t * nbt_parse_alloc(uint8_t **p, uint8_t type, int named, int flags) {
+    nbt_arena a;
+    lh_clear_obj(a);
+    a.flags = flags;
+
+    uint8_t *q = *p;
+    ssize_t size = nbt_measure(&q, type, named, &a);
+    a.mem = malloc(size);
+    assert(a.mem);
+
+    nbt_t *nbt = nbt_parse_arena(p, type, named, &a);
+    assert(a.used == size);
+    nbt->arena = NBT_ARENA_ROOT;
+
+    lh_arr_free(GAR(a.cnt));
+    return nbt;
+}
+
+// parse NBT object from serialized data, with the allocation mode
+// selected by flags (NBT_ARENA or NBT_VIEW, 0 for the regular parser).
+// Arena trees are read-only in structure - elements may not be added
+nbt_t * nbt_parse_ex(uint8_t **p, int flags) {
+    if (!(flags&NBT_ARENA)) return nbt_parse(p);
+
+    uint8_t type = lh_read_char(*p);
+    if (type == NBT_END) return NULL;
+    return nbt_parse_alloc(p, type, 1, flags);
+}
+
+// Serialization goes through a writer that checks the available space
+// before each write. Fixed buffers fail when they are full, while the
+// compressing writer feeds the staged data to zlib and continues
+
+#define NBT_CHUNK 65536
+
+typedef struct nbt_writer {
+    uint8_t  *w;        // current write position
+    uint8_t  *lim;      // end of the available space, NULL if unbounded
+    int     (*drain)(struct nbt_writer *wr); // make room, 0 on failure
+
+    // compressing writer
+    z_stream  zs;
+    uint8_t  *stage;    // staging buffer with the serialized data
+    lh_arr_declare(uint8_t,out); // compressed output
+} nbt_writer;
+
+// ensure that n bytes (n<=NBT_CHUNK) can be written
+static inline int wr_room(nbt_writer *wr, ssize_t n) {
+    if (!wr->lim || wr->w+n <= wr->lim) return 1;
+    return wr->drain && wr->drain(wr) && wr->w+n <= wr->lim;
+}
+
+static int wr_bytes(nbt_writer *wr, const uint8_t *src, ssize_t n) {
+    while (n > 0) {
+        if (!wr_room(wr, 1)) return 0;
+        ssize_t k = n;
+        if (wr->lim && k > wr->lim-wr->w) k = wr->lim-wr->w;
+        memmove(wr->w, src, k);
+        wr->w += k;
+        src += k;
+        n -= k;
+    }
+    return 1;
+}
+
+#define WR_ROOM(n) if (!wr_room(wr, (n))) return 0
+
+static int nbt_emit(nbt_writer *wr, nbt_t *nbt) {
     if (!nbt) {
-        lh_write_char(*w, NBT_END); // write terminating token
-        return;
+        WR_ROOM(1);
+        lh_write_char(wr->w, NBT_END); // write terminating token
+        return 1;
     }
 
     // if the object is unnamed - don't write type or name
     if (nbt->name) {
-        lh_write_char(*w, nbt->type);
         ssize_t nlen = strlen(nbt->name);
-        lh_write_short_be(*w, nlen);
-        memmove(*w, nbt->name, nlen);
-        *w += nlen;
+        WR_ROOM(3);
+        lh_write_char(wr->w, nbt->type);
+        lh_write_short_be(wr->w, nlen);
+        if (!wr_bytes(wr, (uint8_t *)nbt->name, nlen)) return 0;
     }
 
     int i;
     switch (nbt->type) {
         case NBT_BYTE:
-            lh_write_char(*w, nbt->b);
+            WR_ROOM(1);
+            lh_write_char(wr->w, nbt->b);
             break;
 
         case NBT_SHORT:
-            lh_write_short_be(*w, nbt->s);
+            WR_ROOM(2);
+            lh_write_short_be(wr->w, nbt->s);
             break;
 
         case NBT_INT:
-            lh_write_int_be(*w, nbt->i);
+            WR_ROOM(4);
+            lh_write_int_be(wr->w, nbt->i);
             break;
 
         case NBT_LONG:
-            lh_write_long_be(*w, nbt->l);
+            WR_ROOM(8);
+            lh_write_long_be(wr->w, nbt->l);
             break;
 
         case NBT_FLOAT:
-            lh_write_float_be(*w, nbt->f);
+            WR_ROOM(4);
+            lh_write_float_be(wr->w, nbt->f);
             break;
 
         case NBT_DOUBLE:
-            lh_write_double_be(*w, nbt->d);
+            WR_ROOM(8);
+            lh_write_double_be(wr->w, nbt->d);
             break;
 
         case NBT_BYTE_ARRAY:
-            lh_write_int_be(*w, nbt->count);
-            memmove(*w, nbt->ba, nbt->count);
-            *w += nbt->count;
-            break;
+            WR_ROOM(4);
+            lh_write_int_be(wr->w, nbt->count);
+            return wr_bytes(wr, (uint8_t *)nbt->ba, nbt->count);
 
         case NBT_INT_ARRAY:
-            lh_write_int_be(*w, nbt->count);
-            for(i=0; i<nbt->count; i++)
-                lh_write_int_be(*w, nbt->ia[i]);
+            WR_ROOM(4);
+            lh_write_int_be(wr->w, nbt->count);
+            for(i=0; i<nbt->count; i++) {
+                WR_ROOM(4);
+                lh_write_int_be(wr->w, nbt->ia[i]);
+            }
             break;
 
         case NBT_STRING:
-            lh_write_short_be(*w, strlen(nbt->st));
-            memmove(*w, nbt->st, nbt->count);
-            *w += nbt->count;
+            WR_ROOM(2);
+            lh_write_short_be(wr->w, strlen(nbt->st));
+            return wr_bytes(wr, (uint8_t *)nbt->st, nbt->count);
+
+        case NBT_LIST:
+            WR_ROOM(5);
+            lh_write_char(wr->w, nbt->ltype);
+            lh_write_int_be(wr->w, nbt->count);
+            for(i=0; i<nbt->count; i++)
+                if (!nbt_emit(wr, nbt->li[i])) return 0;
             break;
 
-        case NBT_LIST: {
-            lh_write_char(*w, nbt->ltype);
-            lh_write_int_be(*w, nbt->count);
+        case NBT_COMPOUND:
+            for(i=0; i<nbt->count; i++)
+                if (!nbt_emit(wr, nbt->co[i])) return 0;
+            WR_ROOM(1);
+            lh_write_char(wr->w, NBT_END);
+            break;
+    }
+
+    return 1;
+}
+
+// exact size of the serialized NBT object
+ssize_t nbt_size(nbt_t *nbt) {
+    if (!nbt) return 1;
+
+    ssize_t size = nbt->name ? 3+strlen(nbt->name) : 0;
+
+    int i;
+    switch (nbt->type) {
+        case NBT_BYTE:          size += 1; break;
+        case NBT_SHORT:         size += 2; break;
+        case NBT_INT:
+        case NBT_FLOAT:         size += 4; break;
+        case NBT_LONG:
+        case NBT_DOUBLE:        size += 8; break;
+        case NBT_BYTE_ARRAY:    size += 4+nbt->count; break;
+        case NBT_INT_ARRAY:     size += 4+nbt->count*4; break;
+        case NBT_STRING:        size += 2+nbt->count; break;
+
+        case NBT_LIST:
+            size += 5;
+            for(i=0; i<nbt->count; i++)
+                size += nbt_size(nbt->li[i]);
+            break;
 
+        case NBT_COMPOUND:
             for(i=0; i<nbt->count; i++)
-                nbt_write(w, nbt->li[i]);
+                size += nbt_size(nbt->co[i]);
+            size += 1;
+            break;
+    }
+
+    return size;
+}
+
+// serialize NBT object to a buffer
+//FIXME: this function assumes the output buffer has sufficient size
+//(typically, it will be the MAXPLEN (4MiB) buffer in mcproxy used for packet encoding)
+void nbt_write(uint8_t **w, nbt_t *nbt) {
+    nbt_writer wr;
+    lh_clear_obj(wr);
+    wr.w = *w;
+    nbt_emit(&wr, nbt);
+    *w = wr.w;
+}
 
+// serialize NBT object to a buffer of given size
+// returns the number of bytes written or -1 if the buffer is too small
+ssize_t nbt_write_to(uint8_t *buf, ssize_t len, nbt_t *nbt) {
+    nbt_writer wr;
+    lh_clear_obj(wr);
+    wr.w = buf;
+    wr.lim = buf+len;
+    return nbt_emit(&wr, nbt) ? wr.w-buf : -1;
+}
+
+// serialize NBT object to an allocated buffer of the exact size
+uint8_t * nbt_serialize(nbt_t *nbt, ssize_t *len) {
+    *len = nbt_size(nbt);
+    lh_create_buf(buf, *len);
+    uint8_t *w = buf;
+    nbt_write(&w, nbt);
+    assert(w-buf == *len);
+    return buf;
+}
+
+static int wr_deflate(nbt_writer *wr, int flush) {
+    wr->zs.next_in  = wr->stage;
+    wr->zs.avail_in = wr->w-wr->stage;
+    do {
+        ssize_t oidx = C(wr->out);
+        lh_arr_add(GAR4(wr->out), NBT_CHUNK);
+        wr->zs.next_out  = P(wr->out)+oidx;
+        wr->zs.avail_out = NBT_CHUNK;
+        int res = deflate(&wr->zs, flush);
+        C(wr->out) -= wr->zs.avail_out;
+        if (res == Z_STREAM_ERROR) return 0;
+    } while (wr->zs.avail_out == 0);
+
+    wr->w = wr->stage;
+    return 1;
+}
+
+static int wr_drain_zlib(nbt_writer *wr) {
+    return wr_deflate(wr, Z_NO_FLUSH);
+}
+
+// serialize and compress NBT object without an intermediate buffer for
+// the whole data - zlib format, or gzip if gzip is set. Returns an
+// allocated buffer with the compressed data, or NULL on error
+uint8_t * nbt_compress(nbt_t *nbt, int gzip, ssize_t *clen) {
+    nbt_writer wr;
+    lh_clear_obj(wr);
+    if (deflateInit2(&wr.zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+                     gzip ? 31 : 15, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+        return NULL;
+
+    lh_alloc_buf(wr.stage, NBT_CHUNK);
+    wr.w = wr.stage;
+    wr.lim = wr.stage+NBT_CHUNK;
+    wr.drain = wr_drain_zlib;
+
+    int ok = nbt_emit(&wr, nbt) && wr_deflate(&wr, Z_FINISH);
+    deflateEnd(&wr.zs);
+    lh_free(wr.stage);
+
+    if (!ok) {
+        lh_arr_free(GAR4(wr.out));
+        return NULL;
+    }
+
+    *clen = C(wr.out);
+    return P(wr.out);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// streaming reader
+
+// skip over the payload of a token without parsing it
+static void nbt_skip(uint8_t **p, uint8_t type) {
+    static const int fixed[] = { 0, 1, 2, 4, 8, 4, 8 };
+    int32_t i, n;
+
+    switch (type) {
+        case NBT_BYTE:
+        case NBT_SHORT:
+        case NBT_INT:
+        case NBT_LONG:
+        case NBT_FLOAT:
+        case NBT_DOUBLE:
+            *p += fixed[type];
+            break;
+
+        case NBT_BYTE_ARRAY:
+            n = lh_read_int_be(*p);
+            *p += n;
+            break;
+
+        case NBT_INT_ARRAY:
+            n = lh_read_int_be(*p);
+            *p += n*4;
+            break;
+
+        case NBT_STRING:
+            n = (uint16_t)lh_read_short_be(*p);
+            *p += n;
+            break;
+
+        case NBT_LIST: {
+            uint8_t ltype = lh_read_char(*p);
+            n = lh_read_int_be(*p);
+            if (n <= 0) break;
+            if (ltype>NBT_END && ltype<=NBT_DOUBLE)
+                *p += n*fixed[ltype];
+            else
+                for(i=0; i<n; i++)
+                    nbt_skip(p, ltype);
             break;
         }
+
         case NBT_COMPOUND: {
-            for(i=0; i<nbt->count; i++)
-                nbt_write(w, nbt->co[i]);
-            lh_write_char(*w, NBT_END);
+            uint8_t ctype;
+            while( (ctype=lh_read_char(*p)) ) {
+                n = (uint16_t)lh_read_short_be(*p);
+                *p += n;
+                nbt_skip(p, ctype);
+            }
             break;
         }
     }
 }
 
+typedef struct {
+    const char **queries;
+    nbt_scan_cb  cb;
+    void        *priv;
+    int          nmatch;
+    char         path[4096];
+    int          plen;
+} nbt_scanner;
+
+// length of the first component of a path
+static inline int path_comp(const char *s) {
+    int n = 0;
+    while (s[n] && s[n]!='/') n++;
+    return n;
+}
+
+// match an element path against a query:
+// 2 - the path matches, 1 - the path leads towards a match, 0 - no match
+static int nbt_qmatch(const char *q, const char *path) {
+    while (*path) {
+        if (!*q) return 0;
+        int ql = path_comp(q), pl = path_comp(path);
+        if (!(ql==1 && q[0]=='*') && (ql!=pl || memcmp(q, path, ql)))
+            return 0;
+        q += ql;    if (*q) q++;
+        path += pl; if (*path) path++;
+    }
+    return *q ? 1 : 2;
+}
+
+static void nbt_scan_children(nbt_scanner *s, uint8_t **p, uint8_t type);
+
+// pass a matching element to the callback - simple values and byte arrays
+// are placed in a temporary object referencing the source data, other types
+// are parsed into an arena tree that is freed after the call
+static void nbt_scan_deliver(nbt_scanner *s, int qi, uint8_t **p, uint8_t type, char *name) {
+    nbt_t el;
+    lh_clear_obj(el);
+    el.type = type;
+    el.count = 1;
+    el.name = name;
+
+    char str[65536];
+
+    switch (type) {
+        case NBT_BYTE:      el.b = lh_read_char(*p);        break;
+        case NBT_SHORT:     el.s = lh_read_short_be(*p);    break;
+        case NBT_INT:       el.i = lh_read_int_be(*p);      break;
+        case NBT_LONG:      el.l = lh_read_long_be(*p);     break;
+        case NBT_FLOAT:     el.f = lh_read_float_be(*p);    break;
+        case NBT_DOUBLE:    el.d = lh_read_double_be(*p);   break;
+
+        case NBT_BYTE_ARRAY:
+            el.count = lh_read_int_be(*p);
+            el.ba = (int8_t *)*p;
+            *p += el.count;
+            break;
+
+        case NBT_STRING:
+            el.count = (uint16_t)lh_read_short_be(*p);
+            memmove(str, *p, el.count);
+            str[el.count] = 0;
+            el.st = str;
+            *p += el.count;
+            break;
+
+        default: {
+            nbt_t *sub = nbt_parse_alloc(p, type, 0, NBT_VIEW);
+            sub->name = name;
+            s->cb(qi, s->path, sub, s->priv);
+            sub->name = NULL;
+            nbt_free(sub);
+            s->nmatch++;
+            return;
+        }
+    }
+
+    s->cb(qi, s->path, &el, s->priv);
+    s->nmatch++;
+}
+
+static void nbt_scan_el(nbt_scanner *s, uint8_t **p, uint8_t type,
+                        const char *comp, int clen, int named) {
+    int plen = s->plen;
+    if (plen+clen+2 > sizeof(s->path)) {
+        nbt_skip(p, type);
+        return;
+    }
+
+    // append the element name or list index to the path
+    if (plen) s->path[s->plen++] = '/';
+    char *name = s->path+s->plen;
+    memmove(name, comp, clen);
+    s->plen += clen;
+    s->path[s->plen] = 0;
+
+    int i, qi=-1, towards=0;
+    for(i=0; s->queries[i]; i++) {
+        int m = nbt_qmatch(s->queries[i], s->path);
+        if (m==2) { qi = i; break; }
+        if (m==1) towards = 1;
+    }
+
+    if (qi >= 0)
+        nbt_scan_deliver(s, qi, p, type, named ? name : NULL);
+    else if (towards && (type==NBT_COMPOUND || type==NBT_LIST))
+        nbt_scan_children(s, p, type);
+    else
+        nbt_skip(p, type);
+
+    s->plen = plen;
+    s->path[plen] = 0;
+}
+
+static void nbt_scan_children(nbt_scanner *s, uint8_t **p, uint8_t type) {
+    int32_t i, n;
+
+    if (type == NBT_COMPOUND) {
+        uint8_t ctype;
+        while( (ctype=lh_read_char(*p)) ) {
+            n = (uint16_t)lh_read_short_be(*p);
+            const char *name = (const char *)*p;
+            *p += n;
+            nbt_scan_el(s, p, ctype, name, n, 1);
+        }
+    }
+    else {
+        uint8_t ltype = lh_read_char(*p);
+        n = lh_read_int_be(*p);
+        for(i=0; i<n; i++) {
+            char idx[16];
+            int ilen = sprintf(idx, "%d", i);
+            nbt_scan_el(s, p, ltype, idx, ilen, 0);
+        }
+    }
+}
+
+// read serialized NBT data and pass the elements matching any of the queries
+// to the callback, without building the tree. Queries are paths relative to
+// the root compound, with list elements addressed by index and '*' matching
+// any single component, e.g. "Level/Sections/*/Blocks". The list of queries
+// is terminated by NULL. Returns the number of matching elements
+int nbt_scan(uint8_t **p, const char **queries, nbt_scan_cb cb, void *priv) {
+    uint8_t type = lh_read_char(*p);
+    if (type == NBT_END) return 0;
+
+    int32_t n = (uint16_t)lh_read_short_be(*p);
+    *p += n;
+
+    if (type != NBT_COMPOUND) {
+        nbt_skip(p, type);
+        return 0;
+    }
+
+    nbt_scanner s;
+    s.queries = queries;
+    s.cb = cb;
+    s.priv = priv;
+    s.nmatch = 0;
+    s.path[0] = 0;
+    s.plen = 0;
+
+    nbt_scan_children(&s, p, type);
+    return s.nmatch;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 // management
 
@@ -287,6 +960,13 @@ void nbt_write(uint8_t **w, nbt_t *nbt) {
 void nbt_free(nbt_t *nbt) {
     if (!nbt) return;
 
+    // arena trees are released as a whole through their root
+    if (nbt->arena) {
+        assert(nbt->arena == NBT_ARENA_ROOT);
+        free(nbt);
+        return;
+    }
+
     int i;
 
     switch (nbt->type) {
@@ -300,6 +980,7 @@ void nbt_free(nbt_t *nbt) {
             lh_free(nbt->li);
             break;
     }
+    lh_free(nbt->hidx);
     lh_free(nbt->name);
     lh_free(nbt);
 }
@@ -369,6 +1050,11 @@ nbt_t * nbt_clone(nbt_t *src) {
             lh_alloc_num(dst->co, dst->count);
             for(i=0; i<dst->count; i++)
                 dst->co[i] = nbt_clone(src->co[i]);
+            if (src->hidx) {
+                ssize_t size = nbt_index_size(src->hidx->mask+1);
+                lh_alloc_buf(dst->hidx, size);
+                memmove(dst->hidx, src->hidx, size);
+            }
             break;
     }
 
@@ -384,6 +1070,13 @@ nbt_t * nbt_hget(nbt_t *nbt, const char *name) {
     if (!nbt) return NULL;
     if (nbt->type != NBT_COMPOUND) return NULL;
 
+    if (!nbt->hidx && !nbt->arena && nbt->count >= NBT_HASH_MIN) {
+        nbt_index *idx;
+        lh_alloc_buf(idx, nbt_index_size(nbt_index_slots(nbt->count)));
+        nbt_index_build(nbt, idx);
+    }
+    if (nbt->hidx) return nbt_index_get(nbt, name);
+
     int i;
     for(i=0; i<nbt->count; i++) {
         const char *elname = nbt->co[i]->name;
@@ -484,6 +1177,7 @@ void nbt_add(nbt_t * nbt, nbt_t * el) {
     assert(el);
 
     assert(nbt->type == NBT_COMPOUND || nbt->type == NBT_LIST);
+    assert(!nbt->arena);
 
     switch (nbt->type) {
         case NBT_COMPOUND:
@@ -496,4 +1190,13 @@ void nbt_add(nbt_t * nbt, nbt_t * el) {
     }
     nbt_t ** nel = lh_arr_new_c(nbt->co, nbt->count, 1);
     *nel = el;
+
+    // keep the name index up to date while it has room, otherwise drop it
+    // and let nbt_hget rebuild it
+    if (nbt->hidx) {
+        if (nbt->count*2 <= nbt->hidx->mask+1)
+            nbt_index_insert(nbt->hidx, el, nbt->count-1);
+        else
+            lh_free(nbt->hidx);
+    }
 }
@@ -68,10 +68,15 @@ Tags
 
 //typedef struct nbt_t nbt_t;
 
+#define NBT_ARENA_NODE  1   // node is part of an arena-allocated tree
+#define NBT_ARENA_ROOT  2   // root of an arena-allocated tree, owns the memory
+
 typedef struct nbt_t {
     int      type;      // type of element
+    int      arena;     // NBT_ARENA_* if the tree was parsed with nbt_parse_ex
     char    *name;      // element name - allocated, must be freed!
     int      ltype;     // type of list elements - only valid for lists
+    struct nbt_index *hidx; // name index - only for large compounds
     ssize_t  count;     // number of elements in the parsed object:
                         // 1 for all elemental types
                         // number of elements in the array for ba, ia
@@ -97,8 +102,23 @@ typedef struct nbt_t {
     };
 } nbt_t;
 
+// flags for nbt_parse_ex
+#define NBT_ARENA       1   // allocate the whole tree in a single block
+#define NBT_VIEW        3   // same, and reference byte arrays in the source
+                            // buffer - it must outlive the tree
+
+// callback for nbt_scan - qi is the index of the matching query, the element
+// is only valid for the duration of the call
+typedef void (*nbt_scan_cb)(int qi, const char *path, nbt_t *el, void *priv);
+
 nbt_t * nbt_parse(uint8_t **p);
+nbt_t * nbt_parse_ex(uint8_t **p, int flags);
+int     nbt_scan(uint8_t **p, const char **queries, nbt_scan_cb cb, void *priv);
 void    nbt_write(uint8_t **w, nbt_t *nbt);
+ssize_t nbt_write_to(uint8_t *buf, ssize_t len, nbt_t *nbt);
+ssize_t nbt_size(nbt_t *nbt);
+uint8_t * nbt_serialize(nbt_t *nbt, ssize_t *len);
+uint8_t * nbt_compress(nbt_t *nbt, int gzip, ssize_t *clen);
 nbt_t * nbt_clone(nbt_t *nbt);
 void    nbt_dump(nbt_t *nbt);
 void    nbt_free(nbt_t *nbt);